@@ -21,9 +21,23 @@ uint32_t send_interval_ms = 10000;  // 10 Second interval
 uint64_t last_sent = 0;             // Last time sent (
 const uint16_t MAX_MSG_SIZE = 512;  // This is the MQTT package size
 uint32_t msg_count = 0;             // How many messages built so far
+volatile boolean wake_up = false;   // Set by the ISRs, the LCD is only touched from the loop
+volatile boolean change_background = false;
+
+// Wake up the LCD, the loop does the actual work as the LCD cannot be used from an ISR
+void IRAM_ATTR wakeupCallback()
+{
+    wake_up = true;
+}
+
+// Change the background colour, again the loop does the drawing
+void IRAM_ATTR changeBackgroundCallback()
+{
+    change_background = true;
+}
 
 // Wake up the LCD
-void wakeupCallback()
+void wakeupLcd()
 {
     Serial.println(F("LCD is waking up!"));
     M5.Lcd.wakeup();
@@ -83,7 +97,7 @@ void setup()
     M5.Lcd.setTextColor(WHITE, BACKGROUND);
     pinMode(CHANGE_PIN, INPUT);    
     attachInterrupt(digitalPinToInterrupt(CHANGE_PIN), 
-              changeBackground, RISING);   
+              changeBackgroundCallback, RISING);   
     // Initialise the WiFi connection
     // There are two signatures for the begin method.  Hotspot with 2 parameters and Enterprise with 3 parameters
     // Hotspot
@@ -108,11 +122,23 @@ void setup()
               wakeupCallback, RISING);
     pinMode(CHANGE_PIN, INPUT);    
     attachInterrupt(digitalPinToInterrupt(CHANGE_PIN), 
-              changeBackground, RISING);              
+              changeBackgroundCallback, RISING);              
 }
 
 void loop()
 {
+    // Act on the buttons pressed since the last pass
+    if (wake_up)
+    {
+        wake_up = false;
+        wakeupLcd();
+    }
+    if (change_background)
+    {
+        change_background = false;
+        changeBackground();
+    }
+
     // No point if we are not connected to the network.
     if (WifiConnection.isConnected())
     {
@@ -8,9 +8,8 @@ sensorsClass *pointerToClass;  // Pointer to the class instance so that the ISR
 auto _timer = timer_create_default();
 
 // ISR callback function based on interrupt PIN
-static void manualISR(){
-    Serial.println(F("Manual Trigger...."));
-    pointerToClass->isrHandler();
+static void IRAM_ATTR manualISR(){
+    pointerToClass->isrHandler();  // Only record it, no Serial/LCD in an ISR
 }
 
 // ISR callback function based on timer interrupt
@@ -64,7 +63,7 @@ void sensorsClass::begin()
 }
 
 // ISR function will call this function to signal that the read function can be called now.
-void sensorsClass::isrHandler()
+void IRAM_ATTR sensorsClass::isrHandler()
 {
     this->_trigger_count++;
     this->_can_read = true;
@@ -3,19 +3,17 @@
 
 #include <Arduino.h>
 
-// AWS Setup           
-const String AWS_EP = "<custom endpoint>.amazonaws.com";    // AWS IoT Core Endpoint
-const String AWS_THING_NAME = "";       // Device Name
-const String AWS_CERT_ID = "";          // 10 Character Certificate ID from AWS
-const String AWS_SHADOW_TOPIC = "$aws/things/" + AWS_THING_NAME + "/shadow/update";
-const String AWS_SHADOW_DELTA_TOPIC = "$aws/things/" + AWS_THING_NAME + "/shadow/update/delta";
-const String AWS_TOPIC = "dev-tel/" + AWS_THING_NAME;
+// AWS Setup - compile time defaults, any value in /config.json on SPIFFS overrides these (see device-config.h)
+const char AWS_EP[] = "<custom endpoint>.amazonaws.com";    // AWS IoT Core Endpoint
+const char AWS_THING_NAME[] = "";       // Device Name, blank uses m5-<MAC address>
+const char AWS_CERT_ID[] = "";          // 10 Character Certificate ID from AWS
+const char AWS_TELEMETRY_PREFIX[] = "dev-tel/";
+const char AWS_METRICS_PREFIX[] = "dev-metrics/";
+const char AWS_METHOD_PREFIX[] = "dev-cmd/";
 const uint8_t AWS_RECONNECT_RETRIES = 20;  // How many times do we retry before giving up!
 const uint16_t AWS_PORT = 8883;
 const uint8_t AWS_QOS_LEVEL = 0;
 
-const String AWS_CA_NAME = "/ca.pem";
-const String AWS_DEVICE_CERTNAME = "/" + AWS_CERT_ID + "-certificate.pem.crt";
-const String AWS_PRIVATE_CERTNAME = "/" + AWS_CERT_ID + "-private.pem.key";
+const char AWS_CA_NAME[] = "/ca.pem";
 
 #endif
@@ -7,41 +7,32 @@
 #include "aws-config.h"
 #include <PubSubClient.h>
 #include <ArduinoJson.h>
-#include "callbacks.h"
+#include "cloud-transport.h"
 
-class AWSIoTClass
+// AWS IoT Core transport, shadow for the state and a standard topic for telemetry.
+// Direct methods are published to dev-cmd/<thing>/<method>.
+class AWSIoTClass : public CloudTransport
 {
     public:
         AWSIoTClass();
-        void begin(TWINUPDATECALLBACK callback, uint8_t y = 70);
+        const char *getName();
+        void begin();
         boolean connect();
-        void sendMessage(JsonObject json, boolean reported = false);
-        void checkForMessage();
-        void enableSending();
-        void disableSending();        
-        uint32_t getSendInterval();   
-        void reportStatus();
-        void desiredUpdate(byte *payload, unsigned int length);         
-        void sendDesiredAccepted(String property, JsonVariant value);
-        void sendDesiredAcceptedAndClear(String property, JsonVariant value);
-        void sendDesiredRejected(String property);
-        uint32_t getMsgCount();
-        uint32_t getLastSent();
+        boolean isConnected();
+        boolean publishNow(TopicType topic, const char *payload);
+        void poll();
+        JsonObject stateReported(JsonDocument &doc);
+        JsonObject stateDesired(JsonDocument &doc);
+        JsonObject deltaProperties(JsonDocument &doc);
+        boolean setClientToken(JsonDocument &doc, uint32_t token);
+        void received(char *topic, byte *payload, unsigned int length);
+        void useClient(Client &client);
+        String readFile(const char* filename);
     
     private:
-        String readFile(const char* filename);
-        void setSendInterval(uint32_t interval);
+        JsonObject stateSection(JsonDocument &doc, const char *section);
         PubSubClient _mqttClient;
         boolean _connected;
-        boolean _send_enabled;
-        uint32_t _send_interval_ms;
-        TWINUPDATECALLBACK _twinCallback;
-        uint32_t _twin_update;
-        uint32_t _control_update;
-        uint32_t _msg_sent;
-        uint32_t _msg_built;
-        uint32_t _last_sent;
-        uint8_t _y;
         String _ca_cert;
         String _device_cert;
         String _private_key;
@@ -0,0 +1,12 @@
+#ifndef AZURE_CONFIG_H
+#define AZURE_CONFIG_H
+
+// Set to 1 to build the Azure IoT Hub transport, requires the ESP32 Azure IoT Arduino library
+#define AZURE_TRANSPORT_ENABLED 0
+
+/*String containing Hostname, Device Id & Device Key in the format:                         */
+/*  "HostName=<host_name>;DeviceId=<device_id>;SharedAccessKey=<device_key>"                */
+/*  "HostName=<host_name>;DeviceId=<device_id>;SharedAccessSignature=<device_sas_token>"    */
+static const char* AZURE_CONNECTION_STRING = "";
+
+#endif
@@ -0,0 +1,102 @@
+#include "azure-iot.h"
+#if AZURE_TRANSPORT_ENABLED
+
+#include "Esp32MQTTClient.h"
+#include "cloud.h"
+
+// Pass the twin update on, both the full and partial documents are handled by deltaProperties
+static void DeviceTwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payLoad, int size)
+{
+    Cloud.received(DELTA_INBOUND, "", (byte *)payLoad, size);
+}
+
+// Pass the direct method on and return the result
+static int DeviceMethodCallback(const char *methodName, const unsigned char *payload, int size, unsigned char **response, int *response_size)
+{
+    int result = Cloud.received(METHOD_INBOUND, methodName, (byte *)payload, size);
+    const char *responseMessage = result < 300 ? "\"Successfully invoke device method\"" : "\"No method found\"";
+    *response_size = strlen(responseMessage) + 1;
+    *response = (unsigned char *)strdup(responseMessage);
+    return result;
+}
+
+// Constructor
+AzureIoTClass::AzureIoTClass()
+    : _connected(false)
+{
+}
+
+// Name of the transport
+const char *AzureIoTClass::getName()
+{
+    return "Azure IoT Hub";
+}
+
+// Nothing to load, the connection string holds the credentials
+void AzureIoTClass::begin()
+{
+}
+
+// Connect to the IoT Hub with twin support
+boolean AzureIoTClass::connect()
+{
+    Serial.println(F("Connecting to Azure IoT Hub"));
+    this->_connected = Esp32MQTTClient_Init((const uint8_t *)AZURE_CONNECTION_STRING, true);
+    if (!this->_connected)
+    {
+        Serial.println("Initializing IoT hub failed.");
+        return false;
+    }
+    Esp32MQTTClient_SetDeviceTwinCallback(DeviceTwinCallback);
+    Esp32MQTTClient_SetDeviceMethodCallback(DeviceMethodCallback);
+    return true;
+}
+
+boolean AzureIoTClass::isConnected()
+{
+    return this->_connected;
+}
+
+// Telemetry and metrics go out as events, IoT Hub has no per device topics, state as a reported property patch
+boolean AzureIoTClass::publishNow(TopicType topic, const char *payload)
+{
+    if (topic == SHADOW_TOPIC)
+    {
+        return Esp32MQTTClient_ReportState(payload);
+    }
+    return Esp32MQTTClient_SendEvent(payload);
+}
+
+void AzureIoTClass::poll()
+{
+    Esp32MQTTClient_Check();
+}
+
+// Reported property patches are the properties themselves
+JsonObject AzureIoTClass::stateReported(JsonDocument &doc)
+{
+    JsonObject root = doc.as<JsonObject>();
+    if (root.isNull())
+    {
+        root = doc.to<JsonObject>();
+    }
+    return root;
+}
+
+// Only the back end can write desired properties
+JsonObject AzureIoTClass::stateDesired(JsonDocument &doc)
+{
+    return JsonObject();
+}
+
+// The full twin has them under desired, a partial update is just the properties plus $version
+JsonObject AzureIoTClass::deltaProperties(JsonDocument &doc)
+{
+    JsonObject root = doc.containsKey("desired") ? doc["desired"].as<JsonObject>() : doc.as<JsonObject>();
+    root.remove("$version");
+    return root;
+}
+
+AzureIoTClass AzureIoT;
+
+#endif
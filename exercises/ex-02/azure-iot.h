@@ -0,0 +1,33 @@
+#ifndef AZURE_IOT_H
+#define AZURE_IOT_H
+
+#include "azure-config.h"
+#if AZURE_TRANSPORT_ENABLED
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "cloud-transport.h"
+
+// Azure IoT Hub transport, device twin for the state and events for telemetry.
+// The device cannot clear the desired properties so rejections are only logged.
+class AzureIoTClass : public CloudTransport
+{
+    public:
+        AzureIoTClass();
+        const char *getName();
+        void begin();
+        boolean connect();
+        boolean isConnected();
+        boolean publishNow(TopicType topic, const char *payload);
+        void poll();
+        JsonObject stateReported(JsonDocument &doc);
+        JsonObject stateDesired(JsonDocument &doc);
+        JsonObject deltaProperties(JsonDocument &doc);
+    private:
+        boolean _connected;
+};
+
+extern AzureIoTClass AzureIoT;
+
+#endif
+#endif
@@ -0,0 +1,264 @@
+#include "broker-stub.h"
+#include "device-config.h"
+
+// MQTT control packet types (upper nibble of the fixed header)
+#define MQTT_CONNECT     0x10
+#define MQTT_CONNACK     0x20
+#define MQTT_PUBLISH     0x30
+#define MQTT_PUBACK      0x40
+#define MQTT_SUBSCRIBE   0x80
+#define MQTT_SUBACK      0x90
+#define MQTT_PINGREQ     0xC0
+#define MQTT_PINGRESP    0xD0
+#define MQTT_DISCONNECT  0xE0
+
+// Constructor
+BrokerStubClient::BrokerStubClient()
+    : _connected(false), _delta_subscribed(false), _hook(NULL), _published(0), _in_length(0), _out_head(0), _out_tail(0)
+{
+}
+
+// The "TCP" connection always succeeds
+int BrokerStubClient::connect(IPAddress ip, uint16_t port)
+{
+    return this->connect("", port);
+}
+
+int BrokerStubClient::connect(const char *host, uint16_t port)
+{
+    this->_connected = true;
+    this->_delta_subscribed = false;
+    this->_in_length = 0;
+    this->_out_head = this->_out_tail = 0;
+    return 1;
+}
+
+size_t BrokerStubClient::write(uint8_t b)
+{
+    return this->write(&b, 1);
+}
+
+// Bytes from PubSubClient.  Collect them until there is a whole packet and then act on it.
+size_t BrokerStubClient::write(const uint8_t *buf, size_t size)
+{
+    if (!this->_connected || this->_in_length + size > sizeof(this->_in))
+    {
+        return 0;
+    }
+    memcpy(this->_in + this->_in_length, buf, size);
+    this->_in_length += size;
+
+    while (this->_in_length >= 2)
+    {
+        // Remaining length is a variable length integer of up to 4 bytes
+        uint32_t remaining = 0;
+        uint32_t multiplier = 1;
+        uint8_t pos = 1;
+        byte digit;
+        do
+        {
+            if (pos >= this->_in_length)
+            {
+                return size;
+            }
+            digit = this->_in[pos++];
+            remaining += (digit & 0x7F) * multiplier;
+            multiplier *= 128;
+        } while ((digit & 0x80) != 0 && pos < 5);
+
+        if (pos + remaining > this->_in_length)
+        {
+            return size;
+        }
+        this->handlePacket(this->_in + pos, remaining, this->_in[0]);
+        this->_in_length -= pos + remaining;
+        memmove(this->_in, this->_in + pos + remaining, this->_in_length);
+    }
+    return size;
+}
+
+// Reply the same way the AWS broker would
+void BrokerStubClient::handlePacket(const byte *packet, uint16_t length, uint8_t header)
+{
+    switch (header & 0xF0)
+    {
+        case MQTT_CONNECT:
+        {
+            const byte connack[] = {MQTT_CONNACK, 0x02, 0x00, 0x00};
+            this->queueToClient(connack, sizeof(connack));
+            break;
+        }
+        case MQTT_SUBSCRIBE:
+        {
+            // Packet id, then a list of topic filters each followed by the QoS
+            uint16_t pos = 2;
+            while (pos + 2 < length)
+            {
+                uint16_t topicLength = (packet[pos] << 8) | packet[pos + 1];
+                const char *delta = DeviceConfig.getShadowDeltaTopic();
+                if (topicLength == strlen(delta) && memcmp(packet + pos + 2, delta, topicLength) == 0)
+                {
+                    this->_delta_subscribed = true;
+                }
+                pos += 2 + topicLength + 1;
+            }
+            const byte suback[] = {MQTT_SUBACK, 0x03, packet[0], packet[1], 0x00};
+            this->queueToClient(suback, sizeof(suback));
+            break;
+        }
+        case MQTT_PUBLISH:
+        {
+            char topic[128];
+            uint16_t topicLength = (packet[0] << 8) | packet[1];
+            uint16_t pos = 2 + topicLength;
+            if (topicLength >= sizeof(topic))
+            {
+                break;
+            }
+            memcpy(topic, packet + 2, topicLength);
+            topic[topicLength] = '\0';
+            if ((header & 0x06) != 0)
+            {
+                const byte puback[] = {MQTT_PUBACK, 0x02, packet[pos], packet[pos + 1]};
+                this->queueToClient(puback, sizeof(puback));
+                pos += 2;
+            }
+            this->_published++;
+            if (this->_hook != NULL)
+            {
+                this->_hook(topic, packet + pos, length - pos);
+            }
+            break;
+        }
+        case MQTT_PINGREQ:
+        {
+            const byte pingresp[] = {MQTT_PINGRESP, 0x00};
+            this->queueToClient(pingresp, sizeof(pingresp));
+            break;
+        }
+        case MQTT_DISCONNECT:
+            this->_connected = false;
+            break;
+    }
+}
+
+// Make bytes available for PubSubClient to read
+boolean BrokerStubClient::queueToClient(const byte *data, uint16_t length)
+{
+    if (this->_out_head == this->_out_tail)
+    {
+        this->_out_head = this->_out_tail = 0;
+    }
+    if (this->_out_tail + length > sizeof(this->_out))
+    {
+        return false;
+    }
+    memcpy(this->_out + this->_out_tail, data, length);
+    this->_out_tail += length;
+    return true;
+}
+
+// Send a QoS 0 publish to the device
+boolean BrokerStubClient::publishToClient(const char *topic, const char *payload)
+{
+    byte packet[BROKER_BUFFER_SIZE / 2];
+    uint16_t topicLength = strlen(topic);
+    uint16_t payloadLength = strlen(payload);
+    uint32_t remaining = 2 + topicLength + payloadLength;
+    uint16_t pos = 0;
+
+    if (remaining + 5 > sizeof(packet))
+    {
+        return false;
+    }
+    packet[pos++] = MQTT_PUBLISH;
+    do
+    {
+        byte digit = remaining % 128;
+        remaining /= 128;
+        packet[pos++] = remaining > 0 ? (digit | 0x80) : digit;
+    } while (remaining > 0);
+    packet[pos++] = topicLength >> 8;
+    packet[pos++] = topicLength & 0xFF;
+    memcpy(packet + pos, topic, topicLength);
+    pos += topicLength;
+    memcpy(packet + pos, payload, payloadLength);
+    pos += payloadLength;
+    return this->queueToClient(packet, pos);
+}
+
+// Deliver a shadow delta document i.e. {"state":{"send_interval":10000}} on the delta topic
+boolean BrokerStubClient::injectDelta(const char *payload)
+{
+    if (!this->_connected || !this->_delta_subscribed)
+    {
+        return false;
+    }
+    return this->publishToClient(DeviceConfig.getShadowDeltaTopic(), payload);
+}
+
+int BrokerStubClient::available()
+{
+    return this->_out_tail - this->_out_head;
+}
+
+int BrokerStubClient::read()
+{
+    if (this->_out_head == this->_out_tail)
+    {
+        return -1;
+    }
+    return this->_out[this->_out_head++];
+}
+
+int BrokerStubClient::read(uint8_t *buf, size_t size)
+{
+    size_t count = min(size, (size_t)this->available());
+    memcpy(buf, this->_out + this->_out_head, count);
+    this->_out_head += count;
+    return count;
+}
+
+int BrokerStubClient::peek()
+{
+    return this->_out_head == this->_out_tail ? -1 : this->_out[this->_out_head];
+}
+
+void BrokerStubClient::flush()
+{
+}
+
+void BrokerStubClient::stop()
+{
+    this->_connected = false;
+}
+
+uint8_t BrokerStubClient::connected()
+{
+    return this->_connected || this->available() > 0;
+}
+
+BrokerStubClient::operator bool()
+{
+    return this->_connected;
+}
+
+// Set the function to be called for every message the device publishes
+void BrokerStubClient::setPublishHook(BROKERPUBLISHHOOK hook)
+{
+    this->_hook = hook;
+}
+
+// How many messages the device has published
+uint32_t BrokerStubClient::getPublished()
+{
+    return this->_published;
+}
+
+// Has the device subscribed to the shadow delta topic
+boolean BrokerStubClient::isDeltaSubscribed()
+{
+    return this->_delta_subscribed;
+}
+
+BrokerStubClient BrokerStub;
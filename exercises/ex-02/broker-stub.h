@@ -0,0 +1,51 @@
+#ifndef BROKER_STUB_H
+#define BROKER_STUB_H
+
+#include <Arduino.h>
+#include <Client.h>
+
+const uint16_t BROKER_BUFFER_SIZE = 1024;   // Must hold at least two MQTT_MAX_PACKET_SIZE packets
+
+typedef void (*BROKERPUBLISHHOOK)(const char *topic, const byte *payload, uint16_t length);
+
+// In-process stand-in for the AWS IoT MQTT broker.  It looks like a network Client to
+// PubSubClient so the real AWSIoTClass code can be driven without an AWS endpoint.
+// Only understands the packets PubSubClient sends (QoS 0/1, no retained messages).
+class BrokerStubClient : public Client
+{
+    public:
+        BrokerStubClient();
+        int connect(IPAddress ip, uint16_t port);
+        int connect(const char *host, uint16_t port);
+        size_t write(uint8_t b);
+        size_t write(const uint8_t *buf, size_t size);
+        int available();
+        int read();
+        int read(uint8_t *buf, size_t size);
+        int peek();
+        void flush();
+        void stop();
+        uint8_t connected();
+        operator bool();
+        boolean injectDelta(const char *payload);
+        void setPublishHook(BROKERPUBLISHHOOK hook);
+        uint32_t getPublished();
+        boolean isDeltaSubscribed();
+    private:
+        void handlePacket(const byte *packet, uint16_t length, uint8_t header);
+        boolean queueToClient(const byte *data, uint16_t length);
+        boolean publishToClient(const char *topic, const char *payload);
+        boolean _connected;
+        boolean _delta_subscribed;
+        BROKERPUBLISHHOOK _hook;
+        uint32_t _published;
+        byte _in[BROKER_BUFFER_SIZE];
+        uint16_t _in_length;
+        byte _out[BROKER_BUFFER_SIZE];
+        uint16_t _out_head;
+        uint16_t _out_tail;
+};
+
+extern BrokerStubClient BrokerStub;
+
+#endif
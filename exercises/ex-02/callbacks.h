@@ -3,5 +3,14 @@
 #include <ArduinoJson.h>
 
 typedef void (*TWINUPDATECALLBACK)(JsonObject payload);
+typedef int (*METHODCALLBACK)(const char *method, JsonObject payload);
 
-#endif
\ No newline at end of file
+struct DeviceEvent;
+typedef void (*EVENTHANDLER)(const DeviceEvent *event);
+
+struct ButtonEvent;
+typedef void (*BUTTONCALLBACK)(const ButtonEvent *event);
+
+typedef void (*JOBCALLBACK)();
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef CLOUD_TRANSPORT_H
+#define CLOUD_TRANSPORT_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+const uint16_t CLOUD_MAX_PAYLOAD = 512;     // Largest message any of the transports will carry
+const uint8_t CLOUD_MAX_METHOD_NAME = 32;   // Longest direct method name
+
+typedef enum {
+    TELEMETRY_TOPIC,
+    SHADOW_TOPIC,
+    METRICS_TOPIC
+} TopicType;
+
+typedef enum {
+    DELTA_INBOUND,
+    METHOD_INBOUND
+} InboundType;
+
+// Everything the application needs from a cloud backend.  The shadow (AWS) and
+// device twin (Azure) layouts differ so the transport builds the state sections.
+class CloudTransport
+{
+    public:
+        virtual ~CloudTransport() {}
+        virtual const char *getName() = 0;
+        virtual void begin() = 0;
+        virtual boolean connect() = 0;
+        virtual boolean isConnected() = 0;
+        // Publish straight away, only the network task should call this once it is running.
+        virtual boolean publishNow(TopicType topic, const char *payload) = 0;
+        // Service the connection, only the network task should call this once it is running.
+        virtual void poll() = 0;
+        // Get/create the reported or desired section of a state document
+        virtual JsonObject stateReported(JsonDocument &doc) = 0;
+        virtual JsonObject stateDesired(JsonDocument &doc) = 0;
+        // Get the changed properties from an inbound delta document
+        virtual JsonObject deltaProperties(JsonDocument &doc) = 0;
+        // Tag a state document so the backend's acknowledgement can be matched to it, returns
+        // false if the backend does not acknowledge state updates
+        virtual boolean setClientToken(JsonDocument &doc, uint32_t token) { return false; }
+};
+
+#endif
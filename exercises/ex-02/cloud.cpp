@@ -0,0 +1,390 @@
+#include "cloud.h"
+#include "ntp-utility.h"
+#include "profile.h"
+
+// Constructor
+CloudClass::CloudClass()
+    : _transport(NULL), _send_interval_ms(30000), _send_enabled(true), _methodCallback(NULL), _last_sent(0), _connected(false),
+      _keepalive_job(NO_JOB)
+{
+    for (uint8_t i = 0; i < sizeof(this->_fields); i++)
+    {
+        this->_fields[i] = NO_FIELD;
+    }
+}
+
+// Initialise the selected transport and the callbacks
+void CloudClass::begin(CloudTransport *transport, TWINUPDATECALLBACK twinCallback, METHODCALLBACK methodCallback, uint8_t y)
+{
+    this->_transport = transport;
+    this->_twinCallback = twinCallback;
+    this->_methodCallback = methodCallback;
+    this->_y = y;
+    this->_fields[5] = Display.addField("Cloud : ", 0, 32, 40);
+    this->_fields[0] = Display.addField("Messages Sent    : ", 0, y + 10, 10);
+    this->_fields[1] = Display.addField("Control Messages : ", 0, y + 18, 10);
+    this->_fields[2] = Display.addField("Shadow Updates   : ", 0, y + 26, 10);
+    this->_fields[3] = Display.addField("Sending Enabled  : ", 0, y + 34, 5);
+    this->_fields[4] = Display.addField("Send Interval    : ", 0, y + 42, 16);
+    this->_transport->begin();
+    Serial.printf("Using %s transport\r\n", this->_transport->getName());
+    if (this->_keepalive_job == NO_JOB)
+    {
+        this->_keepalive_job = Scheduler.every("keepalive", CLOUD_POLL_MS, keepAliveJob, JOB_HIGH);
+    }
+}
+
+// Connect the transport to its endpoint
+boolean CloudClass::connect()
+{
+    Display.printf(this->_fields[5], "Connecting to %s", this->_transport->getName());
+    Display.publish();
+    this->_connected = this->_transport->connect();
+    Display.printf(this->_fields[5], "%s %s", this->_transport->getName(), this->_connected ? "connected" : "timed out!");
+    Display.publish();
+    return this->_connected;
+}
+
+// Hand the transport over to the network task
+boolean CloudClass::startNetworkTask()
+{
+    if (!NetworkTask.begin(this->_transport))
+    {
+        return false;
+    }
+    Scheduler.cancel(this->_keepalive_job);
+    return true;
+}
+
+// Keep the MQTT connection alive and pick up anything waiting while the loop task owns the transport
+void CloudClass::keepAliveJob()
+{
+    if (Cloud._connected)
+    {
+        Cloud.checkForMessage();
+    }
+}
+
+// Get the transport currently in use
+CloudTransport *CloudClass::getTransport()
+{
+    return this->_transport;
+}
+
+// Called by the transports when a delta or direct method arrives.  If the network task
+// owns the transport it is queued and processed on the loop task by checkForMessage.
+int CloudClass::received(InboundType type, const char *name, byte *payload, unsigned int length)
+{
+    if (NetworkTask.isRunning())
+    {
+        // Direct methods get their real result once processed, the caller only knows it is queued.
+        return NetworkTask.queueInbound(type, name, payload, length) ? 202 : 503;
+    }
+    if (type == METHOD_INBOUND)
+    {
+        return this->methodInvoke(name, payload, length);
+    }
+    this->desiredUpdate(payload, length);
+    return 200;
+}
+
+// Process the delta message for twin/shadow update from the cloud
+void CloudClass::desiredUpdate(byte *payload, unsigned int length)
+{
+    HeapSite site(HEAP_SITE_DELTA);
+    PROFILE_SCOPE(PROBE_DESIRED_UPDATE);
+    Metrics.increment(METRIC_TWIN_UPDATES);
+    DynamicJsonDocument doc(length+1);
+    DeserializationError err = deserializeJson(doc, (char *)payload, length);
+    boolean enabled;
+    int interval;
+
+    JsonObject root = this->_transport->deltaProperties(doc);
+
+    for (JsonObject::iterator it=root.begin(); it!=root.end(); ++it)  {
+        String property = String(it->key().c_str());
+        if(property.equals("send_enabled"))
+        {
+            enabled = it->value().as<boolean>();
+            Serial.printf("Send Enabled is %s\r\n", enabled ? "True": "False");
+            if (enabled != this->_send_enabled)
+            {
+                if (enabled)
+                {
+                    this->enableSending();
+                } else {
+                    this->disableSending();
+                }
+                
+                this->sendDesiredAccepted("send_enabled", it->value());
+            }
+        }
+        if (property.equals("send_interval"))
+        {
+            interval = it->value().as<int>();
+            Serial.printf("Send Interval is %d\r\n", interval);
+            if (interval != this->_send_interval_ms)
+            {
+                this->setSendInterval(interval);
+                this->sendDesiredAccepted("send_interval", it->value());                    
+            }
+        }
+    }
+    this->_twinCallback(root);
+}
+
+// Process a direct method.  start/stop are handled here, anything else goes to the application.
+int CloudClass::methodInvoke(const char *method, byte *payload, unsigned int length)
+{
+    Serial.printf("Method invoked: %s\r\n", method);
+    // start/stop are counted by enableSending/disableSending
+    if (strcmp(method, "start") == 0)
+    {
+        this->enableSending();
+        return 200;
+    }
+    if (strcmp(method, "stop") == 0)
+    {
+        this->disableSending();
+        return 200;
+    }
+    Metrics.increment(METRIC_CONTROL_UPDATES);
+    if (this->_methodCallback == NULL)
+    {
+        return 404;
+    }
+    DynamicJsonDocument doc(length+1);
+    deserializeJson(doc, (char *)payload, length);
+    return this->_methodCallback(method, doc.as<JsonObject>());
+}
+
+// Accept the desired property
+void CloudClass::sendDesiredAccepted(String property, JsonVariant value)
+{
+    HeapSite site(HEAP_SITE_ACK);
+    String payload;
+    Serial.println("Accepting the state");
+    DynamicJsonDocument doc(CLOUD_MAX_PAYLOAD);
+    JsonObject reported = this->_transport->stateReported(doc);
+    reported[property] = value;
+    serializeJson(doc, payload);
+    serializeJsonPretty(doc, Serial);
+    this->publish(CONTROL_LANE, SHADOW_TOPIC, payload);
+}
+
+void CloudClass::sendDesiredAcceptedAndClear(String property, JsonVariant value)
+{
+    HeapSite site(HEAP_SITE_ACK);
+    String payload;
+    Serial.println("Accepting the state");
+    DynamicJsonDocument doc(CLOUD_MAX_PAYLOAD);
+    JsonObject reported = this->_transport->stateReported(doc);
+    reported[property] = value;
+    // Make sure the desired is cleared so not to return a delta.
+    JsonObject desired = this->_transport->stateDesired(doc);
+    desired[property] = serialized("null");
+    serializeJson(doc, payload);
+    serializeJsonPretty(doc, Serial);
+    this->publish(CONTROL_LANE, SHADOW_TOPIC, payload);
+}
+
+// Rejecte the desired property
+void CloudClass::sendDesiredRejected(String property)
+{
+    HeapSite site(HEAP_SITE_ACK);
+    String payload;
+    Serial.println("Rejecting the state");
+    DynamicJsonDocument doc(CLOUD_MAX_PAYLOAD);
+    JsonObject desired = this->_transport->stateDesired(doc);
+    if (desired.isNull())
+    {
+        // Transport cannot clear the desired state (Azure twin), so nothing to send
+        return;
+    }
+    desired[property] = serialized("null");
+    serializeJson(doc, payload);
+    serializeJsonPretty(doc, Serial);
+    this->publish(CONTROL_LANE, SHADOW_TOPIC, payload);
+}
+
+// Get current message count
+uint32_t CloudClass::getMsgCount()
+{
+    return Metrics.get(METRIC_MSG_BUILT);
+}
+
+// Get when last time message was sent
+uint32_t CloudClass::getLastSent()
+{
+    return this->_last_sent;
+}
+
+// Send the message to either standard topic or shadow.  Messages with the same coalesce key
+// replace each other if they are still waiting to be sent.  Each one is traced from when the
+// reading in it was taken (sampleUs, esp_timer time, 0 for now) to the broker, see trace.h.
+// Returns whether it was queued, not that it has gone.
+boolean CloudClass::sendMessage(JsonObject json, boolean reported, uint8_t coalesceKey, int64_t sampleUs)
+{
+    HeapSite site(HEAP_SITE_SEND);
+    PROFILE_SCOPE(PROBE_SEND_MESSAGE);
+    String payload;
+    boolean sent = false;
+    if (this->_connected && this->_send_enabled)
+    {
+        uint32_t trace = Trace.open(sampleUs);
+        _last_sent = millis();
+        json["msg_number"] = Metrics.increment(METRIC_MSG_BUILT);
+        json["timestamp"] = NTPUtility.getEpochMs();
+        Serial.printf("Publish to %s\r\n", reported ? "shadow" : "telemetry");
+        if (reported)
+        {
+            json["send_enabled"] = this->_send_enabled;
+            json["send_interval"] = this->_send_interval_ms;
+            DynamicJsonDocument doc(CLOUD_MAX_PAYLOAD);
+            JsonObject state = this->_transport->stateReported(doc);
+            state.set(json);
+            if (this->_transport->setClientToken(doc, trace))
+            {
+                Trace.expectAck(trace);
+            }
+            Serial.println("------ Send Shadow Data -----");
+            serializeJsonPretty(doc, Serial);
+            Serial.println();
+            serializeJson(doc, payload);
+            Trace.mark(trace, TRACE_SERIALIZE);
+            sent = this->publish(STATE_LANE, SHADOW_TOPIC, payload, coalesceKey, trace);
+            Serial.printf("\r\nJSON Size : %u\r\n", measureJson(doc));
+        }
+        else
+        {
+            if (TRACE_IN_PAYLOAD)
+            {
+                json["trace"] = trace;
+            }
+            Serial.println("------ Send Telemetry Data -----");
+            serializeJsonPretty(json, Serial);
+            Serial.println();
+            serializeJson(json, payload);
+            Trace.mark(trace, TRACE_SERIALIZE);
+            sent = this->publish(TELEMETRY_LANE, TELEMETRY_TOPIC, payload, coalesceKey, trace);
+            Serial.printf("\r\nJSON Size : %u\r\n", measureJson(json));
+        }
+        if (sent)
+        {
+            Metrics.increment(METRIC_MSG_QUEUED);
+        }
+    }
+    Serial.printf("Current sent status is %s\r\n", sent ? "True": "False");
+    return sent;
+}
+
+// Publish what changed in the metrics since the last time on the metrics topic.  Not subject to
+// send_enabled as it is about the device rather than the readings, and never coalesced as each
+// document holds a delta.
+boolean CloudClass::sendMetrics()
+{
+    if (!this->_connected)
+    {
+        return false;
+    }
+    Metrics.set(METRIC_PUBLISH_WAITING, PublishScheduler.getWaiting());
+    StaticJsonDocument<METRICS_DOC_SIZE> doc;
+    JsonObject root = doc.to<JsonObject>();
+    root["timestamp"] = NTPUtility.getEpochMs();
+    Metrics.report(root);
+    String payload;
+    serializeJson(doc, payload);
+    Serial.printf("Publish %u bytes of metrics\r\n", payload.length());
+    return this->publish(TELEMETRY_LANE, METRICS_TOPIC, payload);
+}
+
+void CloudClass::enableSending()
+{
+    Metrics.increment(METRIC_CONTROL_UPDATES);
+    this->_send_enabled = true;
+}
+
+void CloudClass::disableSending()
+{
+    Metrics.increment(METRIC_CONTROL_UPDATES);
+    this->_send_enabled = false;
+}
+
+// Process any waiting deltas/methods, or service the transport directly if there is no network task
+void CloudClass::checkForMessage()
+{
+    if (NetworkTask.isRunning())
+    {
+        InboundMessage msg;
+        while (NetworkTask.nextInbound(&msg))
+        {
+            if (msg.type == METHOD_INBOUND)
+            {
+                this->methodInvoke(msg.name, (byte *)msg.payload, msg.length);
+            }
+            else
+            {
+                this->desiredUpdate((byte *)msg.payload, msg.length);
+            }
+        }
+        return;
+    }
+    this->flush();
+    this->_transport->poll();
+}
+
+// Queue the payload in its lane and let the network task know, if there is no network task
+// send whatever the rate limits allow straight away.
+boolean CloudClass::publish(PublishLane lane, TopicType topic, const String &payload, uint8_t key, uint32_t trace)
+{
+    boolean queued = PublishScheduler.queue(lane, topic, payload.c_str(), payload.length(), key, trace);
+    if (NetworkTask.isRunning())
+    {
+        NetworkTask.wake();
+    }
+    else
+    {
+        this->flush();
+    }
+    return queued;
+}
+
+// Publish the waiting messages the rate limits allow, only used when there is no network task
+void CloudClass::flush()
+{
+    OutboundMessage msg;
+    while (PublishScheduler.next(&msg))
+    {
+        if (this->_transport->publishNow(msg.topic, msg.payload))
+        {
+            Metrics.increment(METRIC_PUBLISHED);
+            Trace.mark(msg.trace, TRACE_WRITE);
+        }
+        else
+        {
+            Metrics.increment(METRIC_PUBLISH_FAILED);
+        }
+    }
+}
+
+uint32_t CloudClass::getSendInterval()
+{
+    return this->_send_interval_ms;
+}
+
+void CloudClass::setSendInterval(uint32_t interval)
+{
+    Metrics.increment(METRIC_CONTROL_UPDATES);
+    this->_send_interval_ms = interval;
+}
+
+void CloudClass::reportStatus()
+{
+    Display.printf(this->_fields[0], "%u", Metrics.get(METRIC_PUBLISHED));
+    Display.printf(this->_fields[1], "%u", Metrics.get(METRIC_CONTROL_UPDATES));
+    Display.printf(this->_fields[2], "%u", Metrics.get(METRIC_TWIN_UPDATES));
+    Display.setText(this->_fields[3], this->_send_enabled ? "True" : "False");
+    Display.printf(this->_fields[4], "%u seconds", this->_send_interval_ms / 1000);
+}
+
+CloudClass Cloud;
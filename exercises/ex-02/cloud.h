@@ -0,0 +1,63 @@
+#ifndef CLOUD_H
+#define CLOUD_H
+
+#include <M5Stack.h>
+#include <ArduinoJson.h>
+#include "callbacks.h"
+#include "cloud-transport.h"
+#include "network-task.h"
+#include "publish-scheduler.h"
+#include "display.h"
+#include "job-scheduler.h"
+#include "metrics.h"
+#include "trace.h"
+#include "heap-monitor.h"
+
+const uint8_t CLOUD_MESSAGE_META_SIZE = 80;   // Text sendMessage adds to telemetry, ,"msg_number":N,"timestamp":N,"trace":N
+const uint16_t CLOUD_POLL_MS = 100;          // How often the keepalive job polls the transport when there is no network task
+
+// Transport independent shadow/twin handling.  The application talks to this
+// class and the selected CloudTransport does the actual sending.
+class CloudClass
+{
+    public:
+        CloudClass();
+        void begin(CloudTransport *transport, TWINUPDATECALLBACK twinCallback, METHODCALLBACK methodCallback = NULL, uint8_t y = 70);
+        boolean connect();
+        boolean startNetworkTask();
+        boolean sendMessage(JsonObject json, boolean reported = false, uint8_t coalesceKey = NO_COALESCE, int64_t sampleUs = 0);
+        boolean sendMetrics();
+        void checkForMessage();
+        void enableSending();
+        void disableSending();
+        uint32_t getSendInterval();
+        void reportStatus();
+        void desiredUpdate(byte *payload, unsigned int length);
+        int methodInvoke(const char *method, byte *payload, unsigned int length);
+        int received(InboundType type, const char *name, byte *payload, unsigned int length);
+        void sendDesiredAccepted(String property, JsonVariant value);
+        void sendDesiredAcceptedAndClear(String property, JsonVariant value);
+        void sendDesiredRejected(String property);
+        uint32_t getMsgCount();
+        uint32_t getLastSent();
+        CloudTransport *getTransport();
+
+    private:
+        void setSendInterval(uint32_t interval);
+        boolean publish(PublishLane lane, TopicType topic, const String &payload, uint8_t key = NO_COALESCE, uint32_t trace = NO_TRACE);
+        void flush();
+        static void keepAliveJob();
+        CloudTransport *_transport;
+        boolean _connected;
+        boolean _send_enabled;
+        uint32_t _send_interval_ms;
+        TWINUPDATECALLBACK _twinCallback;
+        METHODCALLBACK _methodCallback;
+        uint32_t _last_sent;
+        uint8_t _y;
+        int8_t _fields[6];
+        int8_t _keepalive_job;          // Polls the transport until the network task takes over
+};
+
+extern CloudClass Cloud;
+#endif
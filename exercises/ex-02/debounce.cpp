@@ -0,0 +1,183 @@
+#include "debounce.h"
+
+// Every edge of an attached pin, just recorded for the loop
+static void IRAM_ATTR debounceISR(void *arg)
+{
+    DebouncePin *slot = (DebouncePin *)arg;
+    EventQueue.pushPin(slot->source, slot->pin);
+}
+
+// Constructor
+DebounceClass::DebounceClass()
+    : _count(0)
+{
+}
+
+// Debounce a pin.  Both edges are caught and the events are queued under source.
+boolean DebounceClass::attach(uint8_t pin, EventSource source, BUTTONCALLBACK callback, boolean activeLow,
+                              uint32_t stableUs, uint32_t longPressUs)
+{
+    if (this->_count >= DEBOUNCE_MAX_PINS)
+    {
+        Serial.printf("No room to debounce pin %u\r\n", pin);
+        return false;
+    }
+    DebouncePin *slot = &this->_pins[this->_count++];
+    memset(slot, 0, sizeof(DebouncePin));
+    slot->pin = pin;
+    slot->source = source;
+    slot->active_low = activeLow;
+    slot->stable_us = stableUs;
+    slot->long_press_us = longPressUs;
+    slot->callback = callback;
+
+    pinMode(pin, INPUT);
+    slot->raw = slot->state = (digitalRead(pin) == HIGH) != activeLow;
+    slot->raw_since_us = slot->state_since_us = esp_timer_get_time();
+    EventQueue.on(source, DebounceClass::eventHandler);
+    attachInterruptArg(digitalPinToInterrupt(pin), debounceISR, slot, CHANGE);
+    return true;
+}
+
+// EventQueue handler for the attached sources
+void DebounceClass::eventHandler(const DeviceEvent *event)
+{
+    Debounce.feed(event);
+}
+
+// An edge from the ISR.  The first edge after a stable spell starts a burst, the bounces
+// that follow are part of it.
+void DebounceClass::feed(const DeviceEvent *event)
+{
+    DebouncePin *slot = this->find(event->pin);
+    if (slot == NULL)
+    {
+        return;
+    }
+    boolean active = (event->edge == EDGE_RISING) != slot->active_low;
+    slot->edges++;
+    if (!slot->burst)
+    {
+        slot->burst = true;
+        slot->burst_us = event->time_us;
+    }
+    // The same level twice means an edge was missed in between, either way the clock starts again
+    slot->raw = active;
+    slot->raw_since_us = event->time_us;
+    this->tick();
+}
+
+// Commit levels that have been stable long enough and send long presses.  Asks the
+// WakeScheduler to come back when the next of those is due.
+void DebounceClass::tick()
+{
+    int64_t now = esp_timer_get_time();
+    for (uint8_t i = 0; i < this->_count; i++)
+    {
+        DebouncePin *slot = &this->_pins[i];
+        if (slot->burst)
+        {
+            int64_t stable = now - slot->raw_since_us;
+            if (stable < slot->stable_us)
+            {
+                WakeScheduler.after((slot->stable_us - stable) / 1000 + 1);
+                continue;
+            }
+            if (slot->raw == slot->state)
+            {
+                // Settled back where it was, a glitch rather than a press or release
+                slot->burst = false;
+                slot->glitches++;
+            }
+        }
+        if (slot->raw != slot->state)
+        {
+            // Check the pin agrees in case an edge was lost when the queue was full
+            boolean level = (digitalRead(slot->pin) == HIGH) != slot->active_low;
+            if (level != slot->raw)
+            {
+                slot->raw = level;
+                slot->raw_since_us = now;
+                if (!slot->burst)
+                {
+                    slot->burst = true;
+                    slot->burst_us = now;
+                }
+                WakeScheduler.after(slot->stable_us / 1000 + 1);
+                continue;
+            }
+            int64_t started = slot->burst ? slot->burst_us : slot->raw_since_us;
+            uint32_t held = (started - slot->state_since_us) / 1000;
+            slot->state = slot->raw;
+            slot->state_since_us = started;
+            slot->burst = false;
+            slot->long_sent = false;
+            if (slot->state)
+            {
+                slot->presses++;
+                this->emit(slot, BUTTON_PRESS, slot->state_since_us, 0);
+            }
+            else
+            {
+                this->emit(slot, BUTTON_RELEASE, slot->state_since_us, held);
+            }
+        }
+        if (slot->state && !slot->long_sent && slot->long_press_us > 0)
+        {
+            int64_t held = now - slot->state_since_us;
+            if (held >= slot->long_press_us)
+            {
+                slot->long_sent = true;
+                slot->long_presses++;
+                this->emit(slot, BUTTON_LONG_PRESS, slot->state_since_us + slot->long_press_us, held / 1000);
+            }
+            else
+            {
+                WakeScheduler.after((slot->long_press_us - held) / 1000 + 1);
+            }
+        }
+    }
+}
+
+// Is the pin pressed after debouncing
+boolean DebounceClass::isPressed(uint8_t pin)
+{
+    DebouncePin *slot = this->find(pin);
+    return slot != NULL && slot->state;
+}
+
+// State and counters for a pin, NULL if it is not attached
+const DebouncePin *DebounceClass::getPin(uint8_t pin)
+{
+    return this->find(pin);
+}
+
+// Slot for a pin
+DebouncePin *DebounceClass::find(uint8_t pin)
+{
+    for (uint8_t i = 0; i < this->_count; i++)
+    {
+        if (this->_pins[i].pin == pin)
+        {
+            return &this->_pins[i];
+        }
+    }
+    return NULL;
+}
+
+// Hand a classified event to the pin's callback
+void DebounceClass::emit(DebouncePin *slot, ButtonAction action, int64_t timeUs, uint32_t heldMs)
+{
+    if (slot->callback == NULL)
+    {
+        return;
+    }
+    ButtonEvent event;
+    event.pin = slot->pin;
+    event.action = action;
+    event.time_us = timeUs;
+    event.held_ms = heldMs;
+    slot->callback(&event);
+}
+
+DebounceClass Debounce;
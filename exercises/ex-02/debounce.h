@@ -0,0 +1,70 @@
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#include <Arduino.h>
+#include "callbacks.h"
+#include "event-queue.h"
+#include "wake-scheduler.h"
+
+const uint8_t DEBOUNCE_MAX_PINS = 4;
+const uint32_t DEBOUNCE_STABLE_US = 20000;      // A level has to hold this long to count
+const uint32_t DEBOUNCE_LONG_PRESS_US = 1000000;
+
+typedef enum {
+    BUTTON_PRESS,
+    BUTTON_RELEASE,
+    BUTTON_LONG_PRESS               // Still held after the long press time, sent once per press
+} ButtonAction;
+
+struct ButtonEvent {
+    uint8_t pin;
+    uint8_t action;
+    int64_t time_us;                // esp_timer of the first edge of the bounce
+    uint32_t held_ms;               // How long it was pressed, for a release or long press
+};
+
+typedef struct {
+    uint8_t pin;
+    uint8_t source;
+    boolean active_low;             // M5Stack buttons pull the pin low when pressed
+    uint32_t stable_us;
+    uint32_t long_press_us;         // 0 for no long press
+    BUTTONCALLBACK callback;
+    boolean raw;                    // Last level from the ISR, true is active
+    int64_t raw_since_us;
+    boolean state;                  // Debounced level
+    int64_t state_since_us;
+    boolean burst;                  // Edges seen since the level was last stable
+    int64_t burst_us;               // First edge of them, the time the press/release really started
+    boolean long_sent;
+    uint32_t edges;
+    uint32_t glitches;              // Pulses shorter than the stable time
+    uint32_t presses;
+    uint32_t long_presses;
+} DebouncePin;
+
+// Debounces pins from the edge times recorded by their ISR rather than by polling.  Each
+// edge goes through the EventQueue, a level only counts once no other edge has come in for
+// the pin's stable time, so bounces and short glitches are dropped and the press/release
+// keeps the time of the first edge of its bounce.
+class DebounceClass
+{
+    public:
+        DebounceClass();
+        boolean attach(uint8_t pin, EventSource source, BUTTONCALLBACK callback, boolean activeLow = true,
+                       uint32_t stableUs = DEBOUNCE_STABLE_US, uint32_t longPressUs = DEBOUNCE_LONG_PRESS_US);
+        void feed(const DeviceEvent *event);
+        void tick();
+        boolean isPressed(uint8_t pin);
+        const DebouncePin *getPin(uint8_t pin);
+    private:
+        static void eventHandler(const DeviceEvent *event);
+        DebouncePin *find(uint8_t pin);
+        void emit(DebouncePin *slot, ButtonAction action, int64_t timeUs, uint32_t heldMs);
+        DebouncePin _pins[DEBOUNCE_MAX_PINS];
+        uint8_t _count;
+};
+
+extern DebounceClass Debounce;
+
+#endif
@@ -0,0 +1,161 @@
+#include "device-config.h"
+#include "SPIFFS.h"
+
+// Constructor, start with the compile time defaults
+DeviceConfigClass::DeviceConfigClass()
+    : _port(AWS_PORT), _qos(AWS_QOS_LEVEL), _retries(AWS_RECONNECT_RETRIES)
+{
+    strlcpy(this->_endpoint, AWS_EP, sizeof(this->_endpoint));
+    strlcpy(this->_thing_name, AWS_THING_NAME, sizeof(this->_thing_name));
+    strlcpy(this->_cert_id, AWS_CERT_ID, sizeof(this->_cert_id));
+    this->buildNames();
+}
+
+// Load the overrides from the Flash File System and work out the topics
+boolean DeviceConfigClass::begin(const char *filename)
+{
+    boolean loaded = false;
+    if(!SPIFFS.begin(true))
+    {
+        Serial.println("An Error has occurred while mounting SPIFFS");
+    }
+    else if (SPIFFS.exists(filename))
+    {
+        File file = SPIFFS.open(filename);
+        StaticJsonDocument<CONFIG_DOC_SIZE> doc;
+        DeserializationError err = deserializeJson(doc, file);
+        file.close();
+        if (err)
+        {
+            Serial.printf("Failed to read %s : %s\r\n", filename, err.c_str());
+        }
+        else
+        {
+            this->copy(this->_endpoint, sizeof(this->_endpoint), doc["endpoint"]);
+            this->copy(this->_thing_name, sizeof(this->_thing_name), doc["thing_name"]);
+            this->copy(this->_cert_id, sizeof(this->_cert_id), doc["cert_id"]);
+            this->_port = doc["port"] | this->_port;
+            this->_qos = doc["qos"] | this->_qos;
+            this->_retries = doc["retries"] | this->_retries;
+            loaded = true;
+        }
+    }
+
+    // Blank thing name then make one up from the MAC address so each device is unique
+    if (this->_thing_name[0] == '\0')
+    {
+        uint64_t mac = ESP.getEfuseMac();
+        snprintf(this->_thing_name, sizeof(this->_thing_name), "m5-%04x%08x",
+                 (uint16_t)(mac >> 32), (uint32_t)mac);
+    }
+    this->buildNames();
+    Serial.printf("Thing name is %s (%s)\r\n", this->_thing_name, loaded ? filename : "defaults");
+    return loaded;
+}
+
+// Copy a string setting if it is present and not blank
+void DeviceConfigClass::copy(char *dest, size_t size, JsonVariant value)
+{
+    const char *str = value.as<const char *>();
+    if (str != NULL && str[0] != '\0')
+    {
+        strlcpy(dest, str, size);
+    }
+}
+
+// Work out the topic and certificate names once so nothing is built per publish
+void DeviceConfigClass::buildNames()
+{
+    snprintf(this->_shadow_topic, sizeof(this->_shadow_topic), "$aws/things/%s/shadow/update", this->_thing_name);
+    snprintf(this->_shadow_delta_topic, sizeof(this->_shadow_delta_topic), "$aws/things/%s/shadow/update/delta", this->_thing_name);
+    snprintf(this->_shadow_accepted_topic, sizeof(this->_shadow_accepted_topic), "$aws/things/%s/shadow/update/accepted", this->_thing_name);
+    snprintf(this->_telemetry_topic, sizeof(this->_telemetry_topic), "%s%s", AWS_TELEMETRY_PREFIX, this->_thing_name);
+    snprintf(this->_metrics_topic, sizeof(this->_metrics_topic), "%s%s", AWS_METRICS_PREFIX, this->_thing_name);
+    snprintf(this->_method_prefix, sizeof(this->_method_prefix), "%s%s/", AWS_METHOD_PREFIX, this->_thing_name);
+    snprintf(this->_method_topic, sizeof(this->_method_topic), "%s+", this->_method_prefix);
+    snprintf(this->_device_cert, sizeof(this->_device_cert), "/%s-certificate.pem.crt", this->_cert_id);
+    snprintf(this->_private_key, sizeof(this->_private_key), "/%s-private.pem.key", this->_cert_id);
+    this->_method_prefix_length = strlen(this->_method_prefix);
+}
+
+const char *DeviceConfigClass::getEndpoint()
+{
+    return this->_endpoint;
+}
+
+uint16_t DeviceConfigClass::getPort()
+{
+    return this->_port;
+}
+
+uint8_t DeviceConfigClass::getQos()
+{
+    return this->_qos;
+}
+
+uint8_t DeviceConfigClass::getRetries()
+{
+    return this->_retries;
+}
+
+const char *DeviceConfigClass::getThingName()
+{
+    return this->_thing_name;
+}
+
+const char *DeviceConfigClass::getCaName()
+{
+    return AWS_CA_NAME;
+}
+
+const char *DeviceConfigClass::getDeviceCertName()
+{
+    return this->_device_cert;
+}
+
+const char *DeviceConfigClass::getPrivateKeyName()
+{
+    return this->_private_key;
+}
+
+const char *DeviceConfigClass::getShadowTopic()
+{
+    return this->_shadow_topic;
+}
+
+const char *DeviceConfigClass::getShadowDeltaTopic()
+{
+    return this->_shadow_delta_topic;
+}
+
+const char *DeviceConfigClass::getShadowAcceptedTopic()
+{
+    return this->_shadow_accepted_topic;
+}
+
+const char *DeviceConfigClass::getTelemetryTopic()
+{
+    return this->_telemetry_topic;
+}
+
+const char *DeviceConfigClass::getMetricsTopic()
+{
+    return this->_metrics_topic;
+}
+
+const char *DeviceConfigClass::getMethodTopic()
+{
+    return this->_method_topic;
+}
+
+const char *DeviceConfigClass::getMethodPrefix()
+{
+    return this->_method_prefix;
+}
+
+size_t DeviceConfigClass::getMethodPrefixLength()
+{
+    return this->_method_prefix_length;
+}
+
+DeviceConfigClass DeviceConfig;
@@ -0,0 +1,63 @@
+#ifndef DEVICE_CONFIG_H
+#define DEVICE_CONFIG_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "aws-config.h"
+
+const char CONFIG_FILENAME[] = "/config.json";
+const uint16_t CONFIG_DOC_SIZE = 512;
+const uint8_t CONFIG_ENDPOINT_SIZE = 96;
+const uint8_t CONFIG_NAME_SIZE = 64;
+const uint8_t CONFIG_CERT_ID_SIZE = 16;
+const uint8_t CONFIG_TOPIC_SIZE = 128;
+
+// Device settings loaded once at boot into fixed buffers, so one firmware image can be
+// provisioned to many devices by uploading a different /config.json to each one i.e.
+//   {"endpoint":"xxx.amazonaws.com","thing_name":"kitchen-01","cert_id":"1a2b3c4d5e","port":8883,"qos":0}
+// Anything missing keeps the compile time default from aws-config.h.
+class DeviceConfigClass
+{
+    public:
+        DeviceConfigClass();
+        boolean begin(const char *filename = CONFIG_FILENAME);
+        const char *getEndpoint();
+        uint16_t getPort();
+        uint8_t getQos();
+        uint8_t getRetries();
+        const char *getThingName();
+        const char *getCaName();
+        const char *getDeviceCertName();
+        const char *getPrivateKeyName();
+        const char *getShadowTopic();
+        const char *getShadowDeltaTopic();
+        const char *getShadowAcceptedTopic();
+        const char *getTelemetryTopic();
+        const char *getMetricsTopic();
+        const char *getMethodTopic();
+        const char *getMethodPrefix();
+        size_t getMethodPrefixLength();
+    private:
+        void copy(char *dest, size_t size, JsonVariant value);
+        void buildNames();
+        char _endpoint[CONFIG_ENDPOINT_SIZE];
+        char _thing_name[CONFIG_NAME_SIZE];
+        char _cert_id[CONFIG_CERT_ID_SIZE];
+        uint16_t _port;
+        uint8_t _qos;
+        uint8_t _retries;
+        char _device_cert[CONFIG_NAME_SIZE];
+        char _private_key[CONFIG_NAME_SIZE];
+        char _shadow_topic[CONFIG_TOPIC_SIZE];
+        char _shadow_delta_topic[CONFIG_TOPIC_SIZE];
+        char _shadow_accepted_topic[CONFIG_TOPIC_SIZE];
+        char _telemetry_topic[CONFIG_TOPIC_SIZE];
+        char _metrics_topic[CONFIG_TOPIC_SIZE];
+        char _method_prefix[CONFIG_TOPIC_SIZE];
+        char _method_topic[CONFIG_TOPIC_SIZE];
+        size_t _method_prefix_length;
+};
+
+extern DeviceConfigClass DeviceConfig;
+
+#endif
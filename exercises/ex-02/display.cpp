@@ -0,0 +1,333 @@
+#include "display.h"
+#include "profile.h"
+
+// Constructor
+DisplayClass::DisplayClass()
+    : _count(0), _chart_count(0), _write(0), _read(1), _ready(2), _fresh(false), _task(NULL), _frame_ms(DISPLAY_FRAME_MS),
+      _foreground(WHITE), _background(BLACK), _awake(true), _page(DISPLAY_MAIN_PAGE), _frames(0), _drawn(0), _skipped(0), _render_us(0)
+{
+    this->_mux = portMUX_INITIALIZER_UNLOCKED;
+    memset(this->_slots, 0, sizeof(this->_slots));
+    memset(this->_chart_seq, 0, sizeof(this->_chart_seq));
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        this->_slots[i].awake = true;
+    }
+}
+
+// Clear the screen and set the colours used for every field
+void DisplayClass::begin(uint16_t foreground, uint16_t background)
+{
+    this->_foreground = foreground;
+    this->_background = background;
+    M5.Lcd.clear(background);
+    M5.Lcd.setTextSize(1);
+    M5.Lcd.setTextColor(foreground, background);
+}
+
+// Start drawing on a task of its own.  Until then publish() draws straight away.
+boolean DisplayClass::startTask(uint16_t frameMs, uint8_t core)
+{
+    this->_frame_ms = frameMs;
+    if (xTaskCreatePinnedToCore(DisplayClass::taskLoop, "display", DISPLAY_TASK_STACK,
+                                this, DISPLAY_TASK_PRIORITY, &this->_task, core) != pdPASS)
+    {
+        Serial.println(F("Failed to start the display task"));
+        this->_task = NULL;
+        return false;
+    }
+    Serial.printf("Display task running on core %u every %u ms\r\n", core, frameMs);
+    return true;
+}
+
+// Add a labelled value at a fixed place on the screen, returns NO_FIELD when there is no room
+int8_t DisplayClass::addField(const char *label, int16_t x, int16_t y, uint8_t width, uint8_t page)
+{
+    if (this->_count >= DISPLAY_MAX_FIELDS)
+    {
+        Serial.printf("No room for display field %s\r\n", label);
+        return NO_FIELD;
+    }
+    DisplayField *field = &this->_fields[this->_count];
+    field->label = label;
+    field->x = x;
+    field->y = y;
+    field->width = min(width, (uint8_t)(DISPLAY_VALUE_SIZE - 1));
+    field->page = page;
+    field->drawn_length = 0;
+    field->shown = false;
+    field->value[0] = '\0';
+
+    // 1 bit per pixel keeps the whole table to a few KB, the colours are added on the way out
+    field->sprite = new TFT_eSprite(&M5.Lcd);
+    field->sprite->setColorDepth(1);
+    if (field->sprite->createSprite((strlen(label) + field->width) * DISPLAY_CHAR_WIDTH, DISPLAY_CHAR_HEIGHT) == NULL)
+    {
+        Serial.printf("No memory for display field %s, drawing it directly\r\n", label);
+        delete field->sprite;
+        field->sprite = NULL;
+    }
+    // The renderer only looks at fields counted in a snapshot, so it is complete before then
+    return this->_count++;
+}
+
+// Add a chart that is fed through addSample, returns NO_FIELD when there is no room
+int8_t DisplayClass::addChart(SparklineClass *chart)
+{
+    if (this->_chart_count >= DISPLAY_MAX_CHARTS)
+    {
+        return NO_FIELD;
+    }
+    this->_charts[this->_chart_count] = chart;
+    return this->_chart_count++;
+}
+
+// Change the value of a field for the next snapshot
+void DisplayClass::setText(int8_t field, const char *value)
+{
+    if (field < 0 || field >= this->_count)
+    {
+        return;
+    }
+    strlcpy(this->_slots[this->_write].values[field], value, this->_fields[field].width + 1);
+}
+
+// printf style version of setText
+void DisplayClass::printf(int8_t field, const char *format, ...)
+{
+    char value[DISPLAY_VALUE_SIZE];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(value, sizeof(value), format, args);
+    va_end(args);
+    this->setText(field, value);
+}
+
+// Give a chart a new sample.  Charts take one sample per frame which is plenty at the sensor rates.
+void DisplayClass::addSample(int8_t chart, float value)
+{
+    if (chart < 0 || chart >= this->_chart_count)
+    {
+        return;
+    }
+    this->_slots[this->_write].samples[chart] = value;
+    this->_slots[this->_write].sample_seq[chart]++;
+}
+
+// Wake the LCD up or put it to sleep with the next snapshot
+void DisplayClass::setAwake(boolean awake)
+{
+    this->_slots[this->_write].awake = awake;
+}
+
+// Show another page with the next snapshot
+void DisplayClass::setPage(uint8_t page)
+{
+    this->_slots[this->_write].page = page;
+}
+
+// Page the loop has asked for
+uint8_t DisplayClass::getPage()
+{
+    return this->_slots[this->_write].page;
+}
+
+// Hand what has been set so far to the renderer.  The slot just filled in becomes the
+// latest, and the loop carries on in a copy of it so unchanged values stay as they were.
+void DisplayClass::publish()
+{
+    this->_slots[this->_write].count = this->_count;
+    portENTER_CRITICAL(&this->_mux);
+    uint8_t done = this->_write;
+    this->_write = this->_ready;
+    this->_ready = done;
+    this->_fresh = true;
+    portEXIT_CRITICAL(&this->_mux);
+    memcpy(&this->_slots[this->_write], &this->_slots[done], sizeof(DisplaySnapshot));
+
+    if (this->_task == NULL)
+    {
+        this->render();
+    }
+}
+
+// Take the latest snapshot if there is a new one
+boolean DisplayClass::take()
+{
+    boolean fresh = false;
+    portENTER_CRITICAL(&this->_mux);
+    if (this->_fresh)
+    {
+        uint8_t latest = this->_ready;
+        this->_ready = this->_read;
+        this->_read = latest;
+        this->_fresh = false;
+        fresh = true;
+    }
+    portEXIT_CRITICAL(&this->_mux);
+    return fresh;
+}
+
+// Draw a frame at the fixed rate whatever the loop is doing
+void DisplayClass::taskLoop(void *param)
+{
+    DisplayClass *display = (DisplayClass *)param;
+    TickType_t wake = xTaskGetTickCount();
+    while (true)
+    {
+        display->render();
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(display->_frame_ms));
+    }
+}
+
+// Draw the fields that differ from what is on the screen
+void DisplayClass::render()
+{
+    if (!this->take())
+    {
+        return;
+    }
+    PROFILE_SCOPE(PROBE_LCD_RENDER);
+    int64_t start = esp_timer_get_time();
+    const DisplaySnapshot *snapshot = &this->_slots[this->_read];
+
+    if (snapshot->awake != this->_awake)
+    {
+        this->_awake = snapshot->awake;
+        if (this->_awake)
+        {
+            M5.Lcd.wakeup();
+            M5.Lcd.setBrightness(100);
+        }
+        else
+        {
+            M5.Lcd.sleep();
+            M5.Lcd.setBrightness(0);
+        }
+    }
+
+    if (snapshot->page != this->_page)
+    {
+        this->showPage(snapshot->page);
+    }
+
+    for (uint8_t i = 0; i < snapshot->count; i++)
+    {
+        DisplayField *field = &this->_fields[i];
+        if (field->page != this->_page)
+        {
+            continue;
+        }
+        if (!field->shown || strcmp(field->value, snapshot->values[i]) != 0)
+        {
+            this->drawField(field, snapshot->values[i]);
+        }
+        else
+        {
+            this->_skipped++;
+        }
+    }
+    for (uint8_t i = 0; i < this->_chart_count; i++)
+    {
+        if (snapshot->sample_seq[i] != this->_chart_seq[i])
+        {
+            this->_chart_seq[i] = snapshot->sample_seq[i];
+            this->_charts[i]->add(snapshot->samples[i]);
+        }
+        if (this->_page == DISPLAY_MAIN_PAGE)
+        {
+            this->_charts[i]->render();
+        }
+    }
+    this->_frames++;
+    this->_render_us = esp_timer_get_time() - start;
+    Metrics.observe(METRIC_RENDER_TIME, this->_render_us);
+}
+
+// Clear the screen for another page, everything on it is drawn from scratch
+void DisplayClass::showPage(uint8_t page)
+{
+    this->_page = page;
+    M5.Lcd.fillScreen(this->_background);
+    for (uint8_t i = 0; i < this->_count; i++)
+    {
+        this->_fields[i].shown = false;
+        this->_fields[i].drawn_length = 0;
+    }
+    for (uint8_t i = 0; i < this->_chart_count; i++)
+    {
+        this->_charts[i]->invalidate();
+    }
+}
+
+// Compose the label and value off screen and send the box in one go
+void DisplayClass::pushField(DisplayField *field)
+{
+    TFT_eSprite *sprite = field->sprite;
+    sprite->fillSprite(0);
+    sprite->setTextSize(1);
+    sprite->setTextColor(1, 0);
+    sprite->setCursor(0, 0);
+    sprite->print(field->label);
+    sprite->print(field->value);
+    sprite->setBitmapColor(this->_foreground, this->_background);
+    sprite->pushSprite(field->x, field->y);
+}
+
+// Draw one value over the old one.  Without a sprite the text background covers the old
+// characters so only the part of the box the new value no longer reaches needs clearing.
+void DisplayClass::drawField(DisplayField *field, const char *value)
+{
+    PROFILE_SCOPE(PROBE_LCD_FIELD);
+    strlcpy(field->value, value, sizeof(field->value));
+    uint8_t length = strlen(field->value);
+    if (field->sprite != NULL)
+    {
+        this->pushField(field);
+    }
+    else
+    {
+        int16_t valueX = field->x + strlen(field->label) * DISPLAY_CHAR_WIDTH;
+        if (!field->shown)
+        {
+            M5.Lcd.setCursor(field->x, field->y);
+            M5.Lcd.print(field->label);
+        }
+        M5.Lcd.setCursor(valueX, field->y);
+        M5.Lcd.print(field->value);
+        if (field->drawn_length > length)
+        {
+            M5.Lcd.fillRect(valueX + length * DISPLAY_CHAR_WIDTH, field->y,
+                (field->drawn_length - length) * DISPLAY_CHAR_WIDTH, DISPLAY_CHAR_HEIGHT, this->_background);
+        }
+    }
+    field->drawn_length = length;
+    field->shown = true;
+    this->_drawn++;
+}
+
+// How many frames have been drawn
+uint32_t DisplayClass::getFrames()
+{
+    return this->_frames;
+}
+
+// How many fields have been drawn
+uint32_t DisplayClass::getDrawn()
+{
+    return this->_drawn;
+}
+
+// How many fields were skipped because they had not changed
+uint32_t DisplayClass::getSkipped()
+{
+    return this->_skipped;
+}
+
+// How long the last frame took in microseconds
+uint32_t DisplayClass::getRenderTime()
+{
+    return this->_render_us;
+}
+
+DisplayClass Display;
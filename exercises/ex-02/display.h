@@ -0,0 +1,104 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <M5Stack.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sparkline.h"
+#include "metrics.h"
+
+const uint8_t DISPLAY_MAX_FIELDS = 40;
+const uint8_t DISPLAY_MAX_CHARTS = 4;
+const uint8_t DISPLAY_VALUE_SIZE = 48;     // Longest value including the terminator
+const uint8_t DISPLAY_CHAR_WIDTH = 6;      // Text size 1 font
+const uint8_t DISPLAY_CHAR_HEIGHT = 8;
+const int8_t NO_FIELD = -1;
+const uint8_t DISPLAY_MAIN_PAGE = 0;       // Readings, connection and the charts
+const uint8_t DISPLAY_DIAGNOSTICS_PAGE = 1;
+const uint16_t DISPLAY_FRAME_MS = 100;     // 10 frames a second
+const uint8_t DISPLAY_TASK_CORE = 0;       // Keep the SPI time off the loop() core
+const uint32_t DISPLAY_TASK_STACK = 4096;
+const uint8_t DISPLAY_TASK_PRIORITY = 1;   // Below the network task
+
+typedef struct {
+    const char *label;                  // Drawn once, the value goes straight after it
+    int16_t x;
+    int16_t y;
+    uint8_t width;                      // Characters kept for the value
+    uint8_t page;                       // Only drawn while this page is showing
+    uint8_t drawn_length;               // Characters of the value on screen now
+    boolean shown;                      // Has been drawn since the last full redraw
+    char value[DISPLAY_VALUE_SIZE];     // What is on the screen now
+    TFT_eSprite *sprite;                // Off screen copy of the label and value, NULL draws straight to the LCD
+} DisplayField;
+
+// Everything the screen shows at one moment.  The loop fills one in and publishes it,
+// the renderer only ever reads them.
+typedef struct {
+    uint8_t count;                      // Fields that existed when it was published
+    char values[DISPLAY_MAX_FIELDS][DISPLAY_VALUE_SIZE];
+    float samples[DISPLAY_MAX_CHARTS];  // Latest sample for each chart
+    uint32_t sample_seq[DISPLAY_MAX_CHARTS];
+    boolean awake;
+    uint8_t page;                       // Which page to show
+} DisplaySnapshot;
+
+// Retained display model.  Each labelled value on the screen is a field, modules set the
+// values and publish() hands a copy of all of them to the display task through a triple
+// buffer.  The task draws at a fixed frame rate and only redraws the fields that changed,
+// each composed in its own 1 bit sprite in RAM and sent to the panel as one block.
+// Fields belong to a page and only the page being shown is drawn, the charts are on the main page.
+// Nothing else draws to M5.Lcd once begin() has been called.
+class DisplayClass
+{
+    public:
+        DisplayClass();
+        void begin(uint16_t foreground, uint16_t background);
+        boolean startTask(uint16_t frameMs = DISPLAY_FRAME_MS, uint8_t core = DISPLAY_TASK_CORE);
+        int8_t addField(const char *label, int16_t x, int16_t y, uint8_t width, uint8_t page = DISPLAY_MAIN_PAGE);
+        int8_t addChart(SparklineClass *chart);
+        void setText(int8_t field, const char *value);
+        void printf(int8_t field, const char *format, ...);
+        void addSample(int8_t chart, float value);
+        void setAwake(boolean awake);
+        void setPage(uint8_t page);
+        uint8_t getPage();
+        void publish();
+        uint32_t getFrames();
+        uint32_t getDrawn();
+        uint32_t getSkipped();
+        uint32_t getRenderTime();
+    private:
+        static void taskLoop(void *param);
+        boolean take();
+        void render();
+        void drawField(DisplayField *field, const char *value);
+        void showPage(uint8_t page);
+        void pushField(DisplayField *field);
+        DisplayField _fields[DISPLAY_MAX_FIELDS];
+        volatile uint8_t _count;
+        SparklineClass *_charts[DISPLAY_MAX_CHARTS];
+        uint32_t _chart_seq[DISPLAY_MAX_CHARTS];    // Last sample each chart was given
+        volatile uint8_t _chart_count;
+        DisplaySnapshot _slots[3];
+        uint8_t _write;                 // Slot the loop is filling in
+        uint8_t _read;                  // Slot the renderer is drawing from
+        uint8_t _ready;                 // Latest published slot
+        boolean _fresh;                 // Published since the renderer last took one
+        portMUX_TYPE _mux;
+        TaskHandle_t _task;
+        uint16_t _frame_ms;
+        uint16_t _foreground;
+        uint16_t _background;
+        boolean _awake;                 // LCD state the renderer last set
+        uint8_t _page;                  // Page the renderer last drew
+        uint32_t _frames;
+        uint32_t _drawn;                // Fields drawn
+        uint32_t _skipped;              // Fields left alone as nothing changed
+        uint32_t _render_us;            // How long the last frame took
+};
+
+extern DisplayClass Display;
+
+#endif
@@ -0,0 +1,163 @@
+#include "duty-cycle.h"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t boots;
+    uint64_t epoch_ms;                  // Epoch when we went to sleep, time since power on until the clock has been set
+    boolean clock;                      // epoch_ms is a real epoch
+    uint64_t sleep_us;                  // How long we asked to sleep for
+    uint64_t first_ms;                  // Epoch of the first sample in the batch
+    uint8_t count;
+    boolean alarm;                      // Last sample was outside the alarm limits
+    int32_t channel;                    // Last AP so the reconnect can skip the scan
+    uint8_t bssid[6];
+    DutySample samples[DUTY_BATCH_SIZE];
+} DutyState;
+
+RTC_DATA_ATTR static DutyState state;
+static boolean coldBoot = false;
+
+// Check the RTC state survived, anything other than a timer wake up starts again
+void DutyCycleClass::begin()
+{
+    if (state.magic != DUTY_MAGIC || esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER)
+    {
+        memset(&state, 0, sizeof(state));
+        state.magic = DUTY_MAGIC;
+        coldBoot = true;
+    }
+    state.boots++;
+    Serial.printf("Duty cycle boot %u with %u samples waiting\r\n", state.boots, state.count);
+}
+
+// Powered on or reset rather than woken by the timer
+boolean DutyCycleClass::isColdBoot()
+{
+    return coldBoot;
+}
+
+// Has the epoch been set since the power came on
+boolean DutyCycleClass::hasClock()
+{
+    return state.clock;
+}
+
+// The epoch carried over the sleep.  esp_timer starts again on each wake so this is the
+// time we went to sleep plus the sleep plus the time since waking.  Until the clock has been
+// set it counts from power on instead.
+uint64_t DutyCycleClass::getEpochMs()
+{
+    return state.epoch_ms + state.sleep_us / 1000 + millis();
+}
+
+// Set the epoch from a proper source such as NTP.  Samples taken before the first time were
+// stamped from power on, moving the start of the batch moves them all as the offsets are relative.
+void DutyCycleClass::setEpochMs(uint64_t epochMs)
+{
+    if (!state.clock && state.count > 0)
+    {
+        state.first_ms += epochMs - this->getEpochMs();
+    }
+    state.epoch_ms = epochMs - millis();
+    state.sleep_us = 0;
+    state.clock = true;
+}
+
+// Keep a sample, returns true when it is time to send the batch
+boolean DutyCycleClass::add(uint64_t epochMs, float temperature, float humidity, float pressure)
+{
+    if (state.count >= DUTY_BATCH_SIZE)
+    {
+        // Could not send last time so make room, newest samples matter most
+        memmove(&state.samples[0], &state.samples[1], sizeof(DutySample) * (DUTY_BATCH_SIZE - 1));
+        state.first_ms += state.samples[0].offset_ms;
+        uint32_t shift = state.samples[0].offset_ms;
+        for (uint8_t i = 0; i < DUTY_BATCH_SIZE - 1; i++)
+        {
+            state.samples[i].offset_ms -= shift;
+        }
+        state.count--;
+    }
+    if (state.count == 0)
+    {
+        state.first_ms = epochMs;
+    }
+    DutySample *sample = &state.samples[state.count++];
+    sample->offset_ms = epochMs - state.first_ms;
+    sample->temperature = temperature;
+    sample->humidity = humidity;
+    sample->pressure = pressure;
+
+    // Only the change into the alarm range forces a send, not every sample while it stays there
+    boolean alarm = !isnan(temperature) && (temperature < DUTY_ALARM_LOW || temperature > DUTY_ALARM_HIGH);
+    boolean raised = alarm && !state.alarm;
+    state.alarm = alarm;
+    return raised || state.count >= DUTY_BATCH_SIZE;
+}
+
+// How many samples are waiting
+uint8_t DutyCycleClass::getCount()
+{
+    return state.count;
+}
+
+// Epoch of the first sample waiting
+uint64_t DutyCycleClass::getFirstEpochMs()
+{
+    return state.first_ms;
+}
+
+// Sample by age, 0 is the oldest
+const DutySample *DutyCycleClass::getSample(uint8_t index)
+{
+    return index < state.count ? &state.samples[index] : NULL;
+}
+
+// The batch has been sent
+void DutyCycleClass::clear()
+{
+    state.count = 0;
+}
+
+// Remember the AP the connection ended up on
+void DutyCycleClass::saveWiFi(int32_t channel, const uint8_t *bssid)
+{
+    state.channel = channel;
+    if (bssid != NULL)
+    {
+        memcpy(state.bssid, bssid, sizeof(state.bssid));
+    }
+}
+
+// Channel of the last AP, 0 if not known
+int32_t DutyCycleClass::getWiFiChannel()
+{
+    return state.channel;
+}
+
+// BSSID of the last AP, NULL if not known
+const uint8_t *DutyCycleClass::getWiFiBssid()
+{
+    return state.channel > 0 ? state.bssid : NULL;
+}
+
+// How many times we have woken since the power came on
+uint32_t DutyCycleClass::getBoots()
+{
+    return state.boots;
+}
+
+// Deep sleep until the next sample is due, measured from when this wake started
+void DutyCycleClass::sleep()
+{
+    uint32_t awake = millis();
+    uint64_t sleepMs = awake < DUTY_SAMPLE_MS ? DUTY_SAMPLE_MS - awake : 1000;
+    state.epoch_ms = this->getEpochMs();
+    state.sleep_us = sleepMs * 1000;
+    Serial.printf("Awake for %u ms, sleeping for %llu ms\r\n", awake, sleepMs);
+    Serial.flush();
+    esp_sleep_enable_timer_wakeup(state.sleep_us);
+    esp_deep_sleep_start();
+}
+
+DutyCycleClass DutyCycle;
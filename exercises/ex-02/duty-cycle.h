@@ -0,0 +1,45 @@
+#ifndef DUTY_CYCLE_H
+#define DUTY_CYCLE_H
+
+#include <Arduino.h>
+#include "esp_sleep.h"
+
+const uint8_t DUTY_BATCH_SIZE = 12;             // Samples kept in RTC memory before the radio is used
+const uint32_t DUTY_SAMPLE_MS = 60000;          // Time between samples
+const float DUTY_ALARM_LOW = 5.0;               // Temperatures outside these are sent straight away
+const float DUTY_ALARM_HIGH = 35.0;
+const uint32_t DUTY_MAGIC = 0x44555459;         // Marks the RTC state as valid
+
+typedef struct {
+    uint32_t offset_ms;                         // After the first sample in the batch
+    float temperature;
+    float humidity;
+    float pressure;
+} DutySample;
+
+// Deep sleeps between samples.  Everything here lives in RTC slow memory so it survives
+// the sleep, the samples build up until the batch is full or an alarm is crossed and only
+// then does the sketch bring up WiFi, TLS and MQTT to send them.
+class DutyCycleClass
+{
+    public:
+        void begin();
+        boolean isColdBoot();
+        boolean hasClock();
+        uint64_t getEpochMs();
+        void setEpochMs(uint64_t epochMs);
+        boolean add(uint64_t epochMs, float temperature, float humidity, float pressure);
+        uint8_t getCount();
+        uint64_t getFirstEpochMs();
+        const DutySample *getSample(uint8_t index);
+        void clear();
+        void saveWiFi(int32_t channel, const uint8_t *bssid);
+        int32_t getWiFiChannel();
+        const uint8_t *getWiFiBssid();
+        uint32_t getBoots();
+        void sleep();
+};
+
+extern DutyCycleClass DutyCycle;
+
+#endif
@@ -0,0 +1,170 @@
+#include "event-queue.h"
+
+// Constructor, each cell starts with its own index as the sequence
+EventQueueClass::EventQueueClass()
+    : _enqueue(0), _dequeue(0), _high_water(0), _dispatched(0), _unhandled(0), _max_latency_us(0)
+{
+    for (uint8_t i = 0; i < EVENT_SOURCE_COUNT; i++)
+    {
+        this->_handlers[i] = NULL;
+    }
+    for (uint32_t i = 0; i < EVENT_QUEUE_DEPTH; i++)
+    {
+        this->_cells[i].sequence = i;
+    }
+}
+
+// Record an event stamped with the current time.  Safe to call from an ISR.
+boolean IRAM_ATTR EventQueueClass::push(uint8_t source, uint8_t pin, uint8_t edge)
+{
+    uint32_t cycles = xthal_get_ccount();
+    int64_t now = esp_timer_get_time();
+    uint32_t pos = __atomic_load_n(&this->_enqueue, __ATOMIC_RELAXED);
+    Cell *cell;
+    for (;;)
+    {
+        cell = &this->_cells[pos & (EVENT_QUEUE_DEPTH - 1)];
+        int32_t diff = (int32_t)__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (int32_t)pos;
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&this->_enqueue, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            Metrics.increment(METRIC_EVENTS_DROPPED);
+            return false;
+        }
+        else
+        {
+            pos = __atomic_load_n(&this->_enqueue, __ATOMIC_RELAXED);
+        }
+    }
+    cell->event.source = source;
+    cell->event.pin = pin;
+    cell->event.edge = edge;
+    cell->event.cycles = cycles;
+    cell->event.time_us = now;
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+
+    uint32_t depth = pos + 1 - __atomic_load_n(&this->_dequeue, __ATOMIC_RELAXED);
+    if (depth > this->_high_water)
+    {
+        this->_high_water = depth;      // Only a statistic so a lost race does not matter
+    }
+    WakeScheduler.wake();               // Get the loop to deal with it now rather than at its next deadline
+    return true;
+}
+
+// Record a pin event from its ISR, the level of the pin now gives the edge
+boolean IRAM_ATTR EventQueueClass::pushPin(uint8_t source, uint8_t pin)
+{
+    return this->push(source, pin, digitalRead(pin) ? EDGE_RISING : EDGE_FALLING);
+}
+
+// Get the oldest event if there is one
+boolean EventQueueClass::pop(DeviceEvent *event)
+{
+    uint32_t pos = __atomic_load_n(&this->_dequeue, __ATOMIC_RELAXED);
+    Cell *cell;
+    for (;;)
+    {
+        cell = &this->_cells[pos & (EVENT_QUEUE_DEPTH - 1)];
+        int32_t diff = (int32_t)__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (int32_t)(pos + 1);
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&this->_dequeue, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = __atomic_load_n(&this->_dequeue, __ATOMIC_RELAXED);
+        }
+    }
+    *event = cell->event;
+    __atomic_store_n(&cell->sequence, pos + EVENT_QUEUE_DEPTH, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Have events from a source handed to a handler by dispatch()
+void EventQueueClass::on(EventSource source, EVENTHANDLER handler)
+{
+    if (source < EVENT_SOURCE_COUNT)
+    {
+        this->_handlers[source] = handler;
+    }
+}
+
+// Hand every waiting event to its handler, call from task context.  Returns how many there were.
+uint16_t EventQueueClass::dispatch()
+{
+    DeviceEvent event;
+    uint16_t count = 0;
+    while (this->pop(&event))
+    {
+        uint32_t latency = esp_timer_get_time() - event.time_us;
+        Metrics.observe(METRIC_EVENT_LATENCY, latency);
+        if (latency > this->_max_latency_us)
+        {
+            this->_max_latency_us = latency;
+        }
+        EVENTHANDLER handler = event.source < EVENT_SOURCE_COUNT ? this->_handlers[event.source] : NULL;
+        if (handler != NULL)
+        {
+            handler(&event);
+            this->_dispatched++;
+        }
+        else
+        {
+            this->_unhandled++;
+        }
+        count++;
+    }
+    return count;
+}
+
+// How many events were lost because the queue was full
+uint32_t EventQueueClass::getDropped()
+{
+    return Metrics.get(METRIC_EVENTS_DROPPED);
+}
+
+// How many events are waiting now
+uint32_t EventQueueClass::getDepth()
+{
+    return __atomic_load_n(&this->_enqueue, __ATOMIC_RELAXED) - __atomic_load_n(&this->_dequeue, __ATOMIC_RELAXED);
+}
+
+// Most events that have been waiting at once
+uint32_t EventQueueClass::getHighWater()
+{
+    return this->_high_water;
+}
+
+// How many events have been handed to a handler
+uint32_t EventQueueClass::getDispatched()
+{
+    return this->_dispatched;
+}
+
+// How many events had no handler
+uint32_t EventQueueClass::getUnhandled()
+{
+    return this->_unhandled;
+}
+
+// Longest time in microseconds between an event happening and its handler being called
+uint32_t EventQueueClass::getMaxLatency()
+{
+    return this->_max_latency_us;
+}
+
+EventQueueClass EventQueue;
@@ -0,0 +1,72 @@
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include <Arduino.h>
+#include "esp_timer.h"
+#include <xtensa/hal.h>
+#include "callbacks.h"
+#include "wake-scheduler.h"
+#include "metrics.h"
+
+const uint8_t EVENT_QUEUE_DEPTH = 64;   // Must be a power of 2, room for a burst of switch bounce
+
+typedef enum {
+    TRIGGER_EVENT,      // Manual sensor read
+    WAKEUP_EVENT,       // LCD wake up button
+    MOTION_EVENT,       // PIR
+    PAGE_EVENT,         // Display page button
+    HEAP_EVENT,         // Largest free block too small for TLS
+    TIMER_EVENT,        // Automatic sensor read
+    EVENT_SOURCE_COUNT
+} EventSource;
+
+typedef enum {
+    EDGE_NONE,          // Not from a pin
+    EDGE_RISING,        // Pin was high when the ISR ran
+    EDGE_FALLING        // Pin was low when the ISR ran
+} EventEdge;
+
+struct DeviceEvent {
+    uint8_t source;
+    uint8_t pin;
+    uint8_t edge;
+    uint32_t cycles;    // CPU cycle counter when the event happened, for sub microsecond spacing
+    int64_t time_us;    // esp_timer when the event happened, NTPUtility.toEpochMs converts it
+};
+
+// Bounded lock-free queue (Vyukov's MPMC design) so ISRs on either core can record an
+// event and its time without taking a lock.  The loop task calls dispatch() which hands
+// each event to the handler registered for its source.
+class EventQueueClass
+{
+    public:
+        EventQueueClass();
+        boolean push(uint8_t source, uint8_t pin, uint8_t edge = EDGE_NONE);
+        boolean pushPin(uint8_t source, uint8_t pin);
+        boolean pop(DeviceEvent *event);
+        void on(EventSource source, EVENTHANDLER handler);
+        uint16_t dispatch();
+        uint32_t getDropped();
+        uint32_t getDepth();
+        uint32_t getHighWater();
+        uint32_t getDispatched();
+        uint32_t getUnhandled();
+        uint32_t getMaxLatency();
+    private:
+        typedef struct {
+            volatile uint32_t sequence;
+            DeviceEvent event;
+        } Cell;
+        Cell _cells[EVENT_QUEUE_DEPTH];
+        volatile uint32_t _enqueue;
+        volatile uint32_t _dequeue;
+        volatile uint32_t _high_water;  // Most events waiting at once
+        EVENTHANDLER _handlers[EVENT_SOURCE_COUNT];
+        uint32_t _dispatched;
+        uint32_t _unhandled;            // Events with no handler for their source
+        uint32_t _max_latency_us;       // Longest from the ISR to the handler
+};
+
+extern EventQueueClass EventQueue;
+
+#endif
@@ -3,10 +3,29 @@
 #include "wifi-connect.h"
 #include "ntp-utility.h"
 #include "ArduinoJson.h" // Json Library
+#include "device-config.h"
+#include "cloud.h"
 #include "aws-iot.h"
+#include "loopback-transport.h"
+#include "transport-bench.h"
+#include "hot-path-bench.h"
+#include "event-queue.h"
+#include "display.h"
+#include "sparkline.h"
+#include "wake-scheduler.h"
+#include "job-scheduler.h"
+#include "loop-timer.h"
+#include "metrics.h"
+#include "heap-monitor.h"
+#include "profile.h"
+#include "duty-cycle.h"
+#include "debounce.h"
+#include "occupancy.h"
 
 const uint16_t BACKGROUND = PURPLE;
 const uint8_t TRIGGER_PIN = 39;
+const uint8_t MOTION_PIN = 19;      // PIR on the Grove port
+const uint32_t MOTION_STABLE_US = 5000;
 
 // Setup the sensor instance to automatically read every 5 seconds
 // and have manual update as well.
@@ -14,10 +33,14 @@ sensorsClass sensors(ENV_CELSIUS, TRIGGER_PIN, 130, 5000);
 
 // LCD Wakeup/Sleep Variables
 const uint8_t WAKEUP_PIN = 38;
-uint64_t gone_sleep = 0;            // When we went to sleep
 uint32_t go_to_sleep = 15000;       // How long before we go to sleep
+int8_t lcd_sleep_job = NO_JOB;      // One-shot armed each time the LCD wakes
+int8_t publish_job = NO_JOB;
 boolean is_awake = true;            // Is currently asleep
 boolean send_state = false;         // As WiFi uses a timer interrupt we cannot send state update on button press.
+const uint8_t LCD_STATE_KEY = 1;    // Only the latest LCD state report needs to go out
+const uint8_t OCCUPANCY_KEY = 2;    // Likewise the latest occupancy report
+const uint8_t PAGE_PIN = 37;        // Button C flips between the main and diagnostics pages
 
 
 // Initialise Global Variables
@@ -26,12 +49,109 @@ String room = String("Kitchen");   // Where the device is located
 String deviceState = String("On"); // Is the device current on/off - Rejection
 boolean isConnected = false;       // Is currently connected to AWS
 
-// Wake up the LCD
-void wakeupCallback()
+// Fields this sketch owns on the display
+int8_t iso_field = NO_FIELD;
+int8_t built_field = NO_FIELD;
+int8_t room_field = NO_FIELD;
+
+// Trend of the recent readings along the bottom of the screen, drawn by the display task
+SparklineClass temperatureChart(0, 192, 100, 48, YELLOW);
+SparklineClass humidityChart(110, 192, 100, 48, CYAN);
+SparklineClass pressureChart(220, 192, 100, 48, GREEN);
+int8_t temperature_chart = NO_FIELD;
+int8_t humidity_chart = NO_FIELD;
+int8_t pressure_chart = NO_FIELD;
+
+// Which cloud backend to use.  AWSIoT, AzureIoT (see azure-config.h) or LoopbackTransport to run without a cloud.
+CloudTransport *transport = &AWSIoT;
+
+// Set to true to deep sleep between samples and only connect to send a batch (see duty-cycle.h)
+const boolean DUTY_CYCLE_MODE = false;
+
+// A whole batch as JSON: root (device, batch, and msg_number, timestamp, trace from sendMessage),
+// batch (first, offset and the three readings) and the four arrays, plus the copied device string
+const size_t BATCH_DOC_SIZE = 2 * JSON_OBJECT_SIZE(5) + 4 * JSON_ARRAY_SIZE(DUTY_BATCH_SIZE) + 16;
+const uint8_t MQTT_PUBLISH_OVERHEAD = 7;    // Fixed header and topic length in a PubSubClient packet
+const uint32_t BATCH_DRAIN_MS = 2000;       // How long to wait for the batch to go before sleeping
+
+// Set to true to benchmark the AWS code against the in-process broker stub instead of connecting
+const boolean RUN_TRANSPORT_BENCH = false;
+
+// Set to true to time the hot paths (JSON, dates, deltas, messages) against the loopback transport
+const boolean RUN_HOT_PATH_BENCH = false;
+
+// Read the sensors stamped with the time the request actually happened
+void readSensors(int64_t timeUs)
+{
+    if (sensors.read(NTPUtility.toEpochMs(timeUs)))
+    {
+        Display.addSample(temperature_chart, sensors.getTemperature());
+        Display.addSample(humidity_chart, sensors.getHumidity());
+        Display.addSample(pressure_chart, sensors.getPressure());
+    }
+}
+
+// Wake up button once debounced, the LCD cannot be used from an ISR so this runs on the loop task
+void onWakeButton(const ButtonEvent *event)
+{
+    if (event->action == BUTTON_PRESS)
+    {
+        changeLcdState(true);
+    }
+}
+
+// Manual trigger button once debounced, only a press counts so bounces no longer add to the count
+void onTriggerButton(const ButtonEvent *event)
 {
+    if (event->action == BUTTON_PRESS)
+    {
+        sensors.triggered();
+        readSensors(event->time_us);
+    }
+}
+
+// PIR motion once debounced, the occupancy engine decides what is worth sending
+void onMotion(const ButtonEvent *event)
+{
+    if (event->action == BUTTON_PRESS)
+    {
+        Occupancy.motion(event->time_us);
+    }
+}
+
+// Page button once debounced, flips to the loop timings and back.  If the LCD is asleep it just wakes it.
+void onPageButton(const ButtonEvent *event)
+{
+    if (event->action != BUTTON_PRESS)
+    {
+        return;
+    }
+    if (is_awake)
+    {
+        Display.setPage(Display.getPage() == DISPLAY_MAIN_PAGE ? DISPLAY_DIAGNOSTICS_PAGE : DISPLAY_MAIN_PAGE);
+    }
     changeLcdState(true);
 }
 
+// The heap is getting too fragmented for TLS to reconnect, say so while we still can
+void onHeapWarning(const DeviceEvent *event)
+{
+    HeapMonitor.print();
+    if (isConnected)
+    {
+        StaticJsonDocument<MAX_MSG_SIZE> doc;
+        JsonObject root = doc.to<JsonObject>();
+        HeapMonitor.report(root.createNestedObject("heap_warning"));
+        Cloud.sendMessage(root);
+    }
+}
+
+// Automatic read from the sensors timer
+void onReadTimer(const DeviceEvent *event)
+{
+    readSensors(event->time_us);
+}
+
 // LCD goes to sleep
 void changeLcdState(boolean wakeUp)
 {
@@ -39,20 +159,41 @@ void changeLcdState(boolean wakeUp)
     if (wakeUp)
     {
         Serial.println(F("LCD Waking Up!"));
-        M5.Lcd.wakeup();
-        M5.Lcd.setBrightness(100);
     }
     else
     {
         Serial.println(F("LCD Going To Sleep!"));
-        M5.Lcd.sleep();
-        M5.Lcd.setBrightness(0);
     }
     is_awake = wakeUp;
-    gone_sleep = millis();
+    Display.setAwake(wakeUp);
+    if (wakeUp)
+    {
+        Scheduler.schedule(lcd_sleep_job, go_to_sleep);
+    }
+    else
+    {
+        Scheduler.cancel(lcd_sleep_job);
+    }
     send_state = true;
 }
 
+// Nothing pressed for a while
+void lcdSleepJob()
+{
+    changeLcdState(false);
+}
+
+// Telemetry at the cloud's send interval, which a direct method can change
+void publishJob()
+{
+    if (isConnected && NTPUtility.getEpoch() > 1546300800)
+    {
+        buildMessageAndSend();
+        Cloud.reportStatus();
+    }
+    Scheduler.setPeriod(publish_job, Cloud.getSendInterval());
+}
+
 // Analysis the delta from AWS Shadow
 void digitalTwinCallback(JsonObject payload)
 {
@@ -74,7 +215,7 @@ void digitalTwinCallback(JsonObject payload)
             {
                 room = newRoom;
                 // As room change will only happen via the desired state we don't need to clear it.
-                AWSIoT.sendDesiredAccepted(property, it->value());
+                Cloud.sendDesiredAccepted(property, it->value());
                 displayRoom();
             }
         }
@@ -83,7 +224,7 @@ void digitalTwinCallback(JsonObject payload)
             // Always reject the device property update
             newState = it->value().as<String>();
             Serial.printf("Device State is %s\r\n", newState.c_str());
-            AWSIoT.sendDesiredRejected(property);
+            Cloud.sendDesiredRejected(property);
             Serial.println(F("Resetting the State"));
         }
         else if (property.equals("lcd"))
@@ -97,28 +238,27 @@ void digitalTwinCallback(JsonObject payload)
                 // LCD state can be set via desired state and device so we need to clear it as the 
                 // desired state could override the device state i.e. keep switching the LCD on when it just
                 // gone to sleep.
-                AWSIoT.sendDesiredAcceptedAndClear(property, it->value());
+                Cloud.sendDesiredAcceptedAndClear(property, it->value());
             } else {
                 // Ok its the same status so lets just clear it/reject it.
-                AWSIoT.sendDesiredRejected(property);
+                Cloud.sendDesiredRejected(property);
             }
             Serial.println(F("Setting LCD State"));
         }
         else
         {
             // If not known rejected for now
-            AWSIoT.sendDesiredRejected(property);
+            Cloud.sendDesiredRejected(property);
             Serial.println(F("Rejecting LCD State"));
         }
     }
-    AWSIoT.reportStatus();
+    Cloud.reportStatus();
 }
 
 // Display the current room setting
 void displayRoom()
 {
-    M5.Lcd.setCursor(0, 140);
-    M5.Lcd.printf("New Room      : %s                       ", room.c_str());
+    Display.setText(room_field, room.c_str());
 }
 
 // Send LCD Status telemetry
@@ -130,9 +270,21 @@ void buildLcdAndSend()
     JsonObject root = doc.to<JsonObject>();
     root["lcd"] = is_awake;
 
-    AWSIoT.sendMessage(root, true);
-    M5.Lcd.setCursor(0, 60);
-    M5.Lcd.printf("Messages Build : %i\r\n", AWSIoT.getMsgCount());
+    Cloud.sendMessage(root, true, LCD_STATE_KEY);
+    Display.printf(built_field, "%u", Cloud.getMsgCount());
+}
+
+// Send the occupancy on a change of state or at the end of a window
+void buildOccupancyAndSend()
+{
+    Serial.println(F("Sending Occupancy...."));
+    StaticJsonDocument<MAX_MSG_SIZE> doc;
+    JsonObject root = doc.to<JsonObject>();
+    JsonObject occupancy = root.createNestedObject("occupancy");
+    Occupancy.report(occupancy);
+    JsonObject location = root.createNestedObject("location");
+    location["room"] = room;
+    Cloud.sendMessage(root, false, OCCUPANCY_KEY);
 }
 
 // Build a telemetry message that can be sent out
@@ -149,19 +301,234 @@ void buildMessageAndSend()
     JsonObject location = root.createNestedObject("location");
     location["room"] = room;
 
-    AWSIoT.sendMessage(root, true);
-    M5.Lcd.setCursor(0, 60);
-    M5.Lcd.printf("Messages Build : %i\r\n", AWSIoT.getMsgCount());
+    Cloud.sendMessage(root, true, NO_COALESCE, sensors.getReadTime());
+    Display.printf(built_field, "%u", Cloud.getMsgCount());
+}
+
+// Refresh the loop timings on the diagnostics page
+void loopShowJob()
+{
+    LoopTimer.show();
+}
+
+// Send the loop phase timings and start the histograms again
+void loopReportJob()
+{
+    if (isConnected)
+    {
+        Serial.println(F("Sending Loop Timings...."));
+        StaticJsonDocument<LOOP_DOC_SIZE> doc;
+        JsonObject root = doc.to<JsonObject>();
+        JsonObject loop = root.createNestedObject("loop");
+        LoopTimer.report(loop);
+        // The summaries come first, the pass buckets go if the whole lot would be too big to publish
+        size_t limit = CLOUD_MAX_PAYLOAD - 1 - CLOUD_MESSAGE_META_SIZE;
+        if (measureJson(doc) > limit)
+        {
+            Serial.printf("Loop timings are %u bytes, leaving out the pass buckets\r\n", measureJson(doc));
+            loop.remove("pass_buckets");
+        }
+        if (measureJson(doc) > limit)
+        {
+            Serial.printf("Loop timings are still %u bytes, the limit is %u, not sent\r\n", measureJson(doc), limit);
+        }
+        else
+        {
+            Cloud.sendMessage(root);
+        }
+    }
+    LoopTimer.clear();
+}
+
+#if PROFILE_ENABLED
+// Print, send and clear the profiling probes
+void profileJob()
+{
+    Profiler.print();
+    if (isConnected)
+    {
+        StaticJsonDocument<MAX_MSG_SIZE> doc;
+        JsonObject root = doc.to<JsonObject>();
+        Profiler.report(root.createNestedObject("profile"));
+        Cloud.sendMessage(root);
+    }
+    Profiler.clear();
+}
+#endif
+
+// Device metrics on their own topic at their own interval
+void metricsJob()
+{
+    if (isConnected)
+    {
+        Metrics.set(METRIC_RSSI, WiFi.RSSI());
+        Cloud.sendMetrics();
+    }
+}
+
+// One wake up in duty cycle mode.  Take a sample, keep it in RTC memory and only bring up
+// WiFi, TLS and MQTT when the batch is full, an alarm has been crossed or the clock needs setting.
+void runDutyCycle()
+{
+    DutyCycle.begin();
+    Display.setAwake(false);
+    Display.publish();
+    sensors.begin();
+    if (sensors.read(DutyCycle.getEpochMs()))
+    {
+        Serial.printf("Sample %u : %2.1f\r\n", DutyCycle.getCount() + 1, sensors.getTemperature());
+    }
+    boolean send = DutyCycle.add(DutyCycle.getEpochMs(), sensors.getTemperature(), sensors.getHumidity(), sensors.getPressure());
+
+    if (send || !DutyCycle.hasClock())
+    {
+        WifiConnection.begin("", "");
+        if (WifiConnection.connect(DutyCycle.getWiFiChannel(), DutyCycle.getWiFiBssid()))
+        {
+            DutyCycle.saveWiFi(WiFi.channel(), WiFi.BSSID());
+            NTPUtility.begin();
+            if (NTPUtility.isSynced())
+            {
+                DutyCycle.setEpochMs(NTPUtility.getEpochMs());
+            }
+            Cloud.begin(transport, digitalTwinCallback);
+            // Without a clock the batch can not be stamped, keep it until there is one
+            if (send && DutyCycle.hasClock() && Cloud.connect())
+            {
+                uint32_t published = Metrics.get(METRIC_PUBLISHED);
+                uint32_t failed = Metrics.get(METRIC_PUBLISH_FAILED);
+                uint8_t parts = 0;
+                boolean queued = buildBatchAndSend(&parts);
+                // No network task in this mode so push it out before the radio goes off
+                uint32_t start = millis();
+                while (PublishScheduler.getWaiting() > 0 && (millis() - start) < BATCH_DRAIN_MS)
+                {
+                    Cloud.checkForMessage();
+                    delay(10);
+                }
+                // Only forget the samples once every part has actually been published
+                if (queued && PublishScheduler.getWaiting() == 0 && Metrics.get(METRIC_PUBLISH_FAILED) == failed
+                    && Metrics.get(METRIC_PUBLISHED) - published >= parts)
+                {
+                    DutyCycle.clear();
+                }
+                else
+                {
+                    Serial.println(F("Batch not sent, keeping it for the next wake"));
+                }
+            }
+        }
+        WiFi.disconnect(true);
+        WiFi.mode(WIFI_OFF);
+    }
+    DutyCycle.sleep();
+}
+
+// Put count samples from first into a batch message.  The offsets stay relative to the
+// first sample of the whole batch so the parts can be put back together.
+void buildBatch(JsonDocument &doc, uint8_t first, uint8_t count)
+{
+    JsonObject root = doc.to<JsonObject>();
+    root["device"] = deviceState;
+    JsonObject batch = root.createNestedObject("batch");
+    batch["first"] = DutyCycle.getFirstEpochMs();
+    JsonArray offsets = batch.createNestedArray("offset");
+    JsonArray temperature = batch.createNestedArray("temperature");
+    JsonArray humidity = batch.createNestedArray("humidity");
+    JsonArray pressure = batch.createNestedArray("pressure");
+    for (uint8_t i = first; i < first + count; i++)
+    {
+        const DutySample *sample = DutyCycle.getSample(i);
+        offsets.add(sample->offset_ms);
+        temperature.add(sample->temperature);
+        humidity.add(sample->humidity);
+        pressure.add(sample->pressure);
+    }
+}
+
+// Send the samples kept over the deep sleeps, split into as few messages as will fit both
+// the publish queue and a PubSubClient packet.  Returns whether every part was queued.
+boolean buildBatchAndSend(uint8_t *parts)
+{
+    size_t packet = MQTT_MAX_PACKET_SIZE - MQTT_PUBLISH_OVERHEAD - strlen(DeviceConfig.getTelemetryTopic());
+    size_t limit = min((size_t)CLOUD_MAX_PAYLOAD - 1, packet) - CLOUD_MESSAGE_META_SIZE;
+    StaticJsonDocument<BATCH_DOC_SIZE> doc;
+    uint8_t first = 0;
+    *parts = 0;
+    while (first < DutyCycle.getCount())
+    {
+        uint8_t count = DutyCycle.getCount() - first;
+        buildBatch(doc, first, count);
+        while (count > 1 && (doc.overflowed() || measureJson(doc) > limit))
+        {
+            count /= 2;
+            buildBatch(doc, first, count);
+        }
+        if (doc.overflowed() || measureJson(doc) > limit)
+        {
+            Serial.println(F("Batch sample does not fit a message"));
+            return false;
+        }
+        if (!Cloud.sendMessage(doc.as<JsonObject>()))
+        {
+            return false;
+        }
+        (*parts)++;
+        first += count;
+    }
+    return true;
 }
 
 void setup()
 {
     Serial.begin(115200);
+    WakeScheduler.begin();
+    EventQueue.on(TIMER_EVENT, onReadTimer);
+    EventQueue.on(HEAP_EVENT, onHeapWarning);
     // Initialise the LCD screen
     M5.begin();
-    M5.Lcd.clear(BACKGROUND);
-    M5.Lcd.setTextSize(1);
-    M5.Lcd.setTextColor(WHITE, BACKGROUND);
+    if (DUTY_CYCLE_MODE)
+    {
+        DeviceConfig.begin();
+        runDutyCycle();         // Ends in deep sleep
+    }
+    // From here on only the display task draws to the LCD
+    Display.begin(WHITE, BACKGROUND);
+    iso_field = Display.addField("ISO  : ", 0, 50, 24);
+    built_field = Display.addField("Messages Build : ", 0, 60, 10);
+    room_field = Display.addField("New Room      : ", 0, 140, 32);
+    Display.addField("Temperature", 0, 182, 0);
+    Display.addField("Humidity", 110, 182, 0);
+    Display.addField("Pressure", 220, 182, 0);
+    temperatureChart.begin(BACKGROUND);
+    humidityChart.begin(BACKGROUND);
+    pressureChart.begin(BACKGROUND);
+    temperature_chart = Display.addChart(&temperatureChart);
+    humidity_chart = Display.addChart(&humidityChart);
+    pressure_chart = Display.addChart(&pressureChart);
+    LoopTimer.begin();
+    Display.startTask();
+    lcd_sleep_job = Scheduler.once("lcd-sleep", go_to_sleep, lcdSleepJob, JOB_LOW);
+    Scheduler.every("loop-show", LOOP_SHOW_MS, loopShowJob, JOB_LOW);
+    Scheduler.every("loop-report", LOOP_REPORT_MS, loopReportJob, JOB_LOW);
+    HeapMonitor.begin();
+#if PROFILE_ENABLED
+    Scheduler.every("profile", PROFILE_REPORT_MS, profileJob, JOB_LOW);
+#endif
+
+    // Load the per device settings before anything needs the thing name or topics
+    DeviceConfig.begin();
+
+    if (RUN_TRANSPORT_BENCH)
+    {
+        TransportBench.run(digitalTwinCallback);
+        return;
+    }
+    if (RUN_HOT_PATH_BENCH)
+    {
+        HotPathBench.run(&sensors, digitalTwinCallback, buildMessageAndSend);
+        return;
+    }
 
     // Initialise the WiFi connection
     // There are two signatures for the begin method.  Hotspot with 2 parameters and Enterprise with 3 parameters
@@ -175,14 +542,18 @@ void setup()
     WifiConnection.begin("", "");
     WifiConnection.connect();
     WifiConnection.printStatus();
+    Display.publish();
     if (WifiConnection.isConnected())
     {
         // Initialise the Network Time Protocol and sensors libraries
         NTPUtility.begin();
         sensors.begin();
-        AWSIoT.begin(digitalTwinCallback);
-        isConnected = AWSIoT.connect();
-        AWSIoT.reportStatus();
+        Debounce.attach(TRIGGER_PIN, TRIGGER_EVENT, onTriggerButton);
+        Occupancy.begin();
+        Debounce.attach(MOTION_PIN, MOTION_EVENT, onMotion, false, MOTION_STABLE_US, 0);
+        Cloud.begin(transport, digitalTwinCallback);
+        isConnected = Cloud.connect();
+        Cloud.reportStatus();
         displayRoom();
 
         // Did we connect to AWS
@@ -193,45 +564,64 @@ void setup()
             sensors.printStatus();
             buildMessageAndSend();
             buildLcdAndSend();
+
+            publish_job = Scheduler.every("publish", Cloud.getSendInterval(), publishJob);
+            Scheduler.every("metrics", METRICS_INTERVAL_MS, metricsJob, JOB_LOW);
+
+            // From now on all MQTT traffic is handled on the other core
+            Cloud.startNetworkTask();
         }
     }
-    pinMode(WAKEUP_PIN, INPUT);    
-    attachInterrupt(digitalPinToInterrupt(WAKEUP_PIN), 
-              wakeupCallback, RISING);    
+    Display.publish();
+    Debounce.attach(WAKEUP_PIN, WAKEUP_EVENT, onWakeButton);
+    Debounce.attach(PAGE_PIN, PAGE_EVENT, onPageButton);
 }
 
 void loop()
 {
+    // Each phase's time goes into its histogram, see the diagnostics page
+    LoopTimer.start();
+
+    // Sampling, publishing, the NTP sync, LCD sleep and keepalive, the read it queues is dispatched straight after
+    Scheduler.run();
+    LoopTimer.mark(PHASE_JOBS);
+    EventQueue.dispatch();
+    LoopTimer.mark(PHASE_EVENTS);
+    Debounce.tick();
+    LoopTimer.mark(PHASE_DEBOUNCE);
+
     // Check we are connected to the internet
     if (WifiConnection.isConnected())
     {
-        NTPUtility.tick();
-        M5.Lcd.setCursor(0, 50);
-        M5.Lcd.printf("ISO  : %s\r\n", NTPUtility.getISO8601Formatted().c_str());
+        char iso[NTP_ISO8601_SIZE];
+        NTPUtility.getISO8601Formatted(iso, sizeof(iso));
+        Display.setText(iso_field, iso);
+        LoopTimer.mark(PHASE_CLOCK);
 
-        if (((millis() - AWSIoT.getLastSent()) >= AWSIoT.getSendInterval()) && NTPUtility.getEpoch() > 1546300800 && isConnected)
+        if (isConnected && Occupancy.tick())
         {
-            buildMessageAndSend();
-            AWSIoT.reportStatus();
+            buildOccupancyAndSend();
         }
         if (isConnected)
         {
-            AWSIoT.checkForMessage();
+            Cloud.checkForMessage();
         }
+        LoopTimer.mark(PHASE_CLOUD);
         sensors.printStatus();
+        LoopTimer.mark(PHASE_STATUS);
     }
 
-    // Check when to go to asleep
-    if (((millis() - gone_sleep) >= go_to_sleep) 
-        && is_awake )
-    {
-        changeLcdState(false);
-    }    
-
     if (send_state)
     {
        buildLcdAndSend();
     }
 
-    delay(500);
+    // Hand this pass's values to the display task, it redraws only what changed
+    Display.publish();
+    LoopTimer.mark(PHASE_DISPLAY);
+    LoopTimer.finish();
+
+    // Sleep until the next thing is due or an ISR/the network task has something for us
+    WakeScheduler.wait();
+    LoopTimer.mark(PHASE_WAIT);
 }
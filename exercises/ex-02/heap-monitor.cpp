@@ -0,0 +1,153 @@
+#include "heap-monitor.h"
+#include "job-scheduler.h"
+
+static const char *const HEAP_SITE_NAMES[HEAP_SITE_COUNT] = {
+    "certs", "delta", "send", "ack"
+};
+
+// Constructor
+HeapMonitorClass::HeapMonitorClass()
+    : _free(0), _largest(0), _minimum(0), _low(false), _inner(0)
+{
+    memset(this->_sites, 0, sizeof(this->_sites));
+}
+
+// Take the first reading and check again every checkMs
+void HeapMonitorClass::begin(uint32_t checkMs)
+{
+    this->check();
+    Scheduler.every("heap", checkMs, checkJob, JOB_LOW);
+}
+
+void HeapMonitorClass::checkJob()
+{
+    HeapMonitor.check();
+}
+
+// Read the heap, update the gauges and raise the warning when the largest block gets too small
+void HeapMonitorClass::check()
+{
+    this->_free = ESP.getFreeHeap();
+    this->_largest = ESP.getMaxAllocHeap();
+    this->_minimum = ESP.getMinFreeHeap();
+    Metrics.set(METRIC_HEAP_FREE, this->_free);
+    Metrics.set(METRIC_HEAP_LARGEST, this->_largest);
+    Metrics.set(METRIC_HEAP_MINIMUM, this->_minimum);
+    Metrics.set(METRIC_HEAP_FRAGMENTATION, this->getFragmentation());
+
+    if (!this->_low && this->_largest < HEAP_WARN_BLOCK)
+    {
+        this->_low = true;
+        Metrics.increment(METRIC_HEAP_WARNINGS);
+        Serial.printf("Heap low: %u free, largest block %u, TLS needs %u\r\n", this->_free, this->_largest, HEAP_TLS_BLOCK);
+        EventQueue.push(HEAP_EVENT, 0);
+    }
+    else if (this->_low && this->_largest >= HEAP_CLEAR_BLOCK)
+    {
+        this->_low = false;
+    }
+}
+
+// Is the warning raised
+boolean HeapMonitorClass::isLow()
+{
+    return this->_low;
+}
+
+// Percentage of the free heap that is not in the largest block
+uint8_t HeapMonitorClass::getFragmentation()
+{
+    if (this->_free == 0)
+    {
+        return 0;
+    }
+    return 100 - (uint64_t)min(this->_largest, this->_free) * 100 / this->_free;
+}
+
+// Start of a site's scope, the enclosing site's inner count is put aside until it closes
+void HeapMonitorClass::enter(uint32_t *free, uint32_t *block, int32_t *outer)
+{
+    *outer = this->_inner;
+    this->_inner = 0;
+    *free = ESP.getFreeHeap();
+    *block = ESP.getMaxAllocHeap();
+}
+
+// End of a site's scope, charge it with what it left behind less what the sites inside it
+// have already been charged with, and pass the lot on to the enclosing site
+void HeapMonitorClass::leave(HeapSiteId site, uint32_t free, uint32_t block, int32_t outer)
+{
+    HeapSiteStats *stats = &this->_sites[site];
+    int32_t total = (int32_t)(free - ESP.getFreeHeap());
+    int32_t retained = total - this->_inner;
+    this->_inner = outer + total;
+    uint32_t largest = ESP.getMaxAllocHeap();
+    stats->calls++;
+    stats->retained += retained;
+    stats->max_retained = max(stats->max_retained, retained);
+    if (largest < block)
+    {
+        stats->max_block_drop = max(stats->max_block_drop, block - largest);
+    }
+}
+
+// What a site has done
+const HeapSiteStats *HeapMonitorClass::getSite(HeapSiteId site)
+{
+    return &this->_sites[site];
+}
+
+// The site holding on to the most heap
+HeapSiteId HeapMonitorClass::getWorstSite()
+{
+    uint8_t worst = 0;
+    for (uint8_t i = 1; i < HEAP_SITE_COUNT; i++)
+    {
+        if (this->_sites[i].retained > this->_sites[worst].retained)
+        {
+            worst = i;
+        }
+    }
+    return (HeapSiteId)worst;
+}
+
+// The heap now and the site holding on to the most of it, for the warning message
+void HeapMonitorClass::report(JsonObject json)
+{
+    json["free"] = this->_free;
+    json["largest"] = this->_largest;
+    json["minimum"] = this->_minimum;
+    json["fragmentation"] = this->getFragmentation();
+    json["tls_block"] = HEAP_TLS_BLOCK;
+    HeapSiteId worst = this->getWorstSite();
+    JsonObject site = json.createNestedObject("site");
+    site["name"] = HEAP_SITE_NAMES[worst];
+    site["calls"] = this->_sites[worst].calls;
+    site["retained"] = this->_sites[worst].retained;
+}
+
+// Dump every site to the serial port
+void HeapMonitorClass::print()
+{
+    Serial.printf("Heap %u free, largest block %u, minimum %u, %u%% fragmented\r\n",
+        this->_free, this->_largest, this->_minimum, this->getFragmentation());
+    for (uint8_t i = 0; i < HEAP_SITE_COUNT; i++)
+    {
+        const HeapSiteStats *stats = &this->_sites[i];
+        Serial.printf("  %-6s calls %u retained %d max %d block drop %u\r\n", HEAP_SITE_NAMES[i],
+            stats->calls, stats->retained, stats->max_retained, stats->max_block_drop);
+    }
+}
+
+HeapSite::HeapSite(HeapSiteId site)
+    : _site(site)
+{
+    HeapMonitor.enter(&this->_free, &this->_block, &this->_outer);
+}
+
+HeapSite::~HeapSite()
+{
+    HeapMonitor.leave(this->_site, this->_free, this->_block, this->_outer);
+}
+
+HeapMonitorClass HeapMonitor;
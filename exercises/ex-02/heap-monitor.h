@@ -0,0 +1,78 @@
+#ifndef HEAP_MONITOR_H
+#define HEAP_MONITOR_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "metrics.h"
+#include "event-queue.h"
+
+const uint32_t HEAP_CHECK_MS = 5000;            // How often the heap is looked at
+const uint32_t HEAP_TLS_BLOCK = 16384 + 1024;   // mbedTLS input record buffer plus its overhead, needed in one piece to reconnect
+const uint32_t HEAP_WARN_BLOCK = 20480;         // Warn when the largest free block falls below this
+const uint32_t HEAP_CLEAR_BLOCK = 24576;        // and only warn again once it has recovered past this
+
+// Places that allocate with String or DynamicJsonDocument, each HeapSite scope is charged
+// with the heap it leaves behind.  Sites nest (a delta sends accepts which send messages),
+// what an inner site leaves behind is only charged to the inner one.
+typedef enum {
+    HEAP_SITE_CERTS,        // Certificates read into Strings
+    HEAP_SITE_DELTA,        // Parsing a shadow delta
+    HEAP_SITE_SEND,         // Building and queueing a message
+    HEAP_SITE_ACK,          // Desired state accept/reject documents
+    HEAP_SITE_COUNT
+} HeapSiteId;
+
+typedef struct {
+    uint32_t calls;
+    int32_t retained;           // Bytes the site itself has left allocated, summed over its calls
+    int32_t max_retained;       // Most left allocated by one call
+    uint32_t max_block_drop;    // Most the largest free block shrank during one call
+} HeapSiteStats;
+
+// Tracks the free heap, the largest free block and the lowest free heap ever, and how
+// fragmented the heap is (how much of the free heap is not in the largest block).  When the
+// largest block gets close to what TLS needs to reconnect a HEAP_EVENT is queued so the
+// sketch can report it while it still can.  The figures go to the metrics registry.
+class HeapMonitorClass
+{
+    public:
+        HeapMonitorClass();
+        void begin(uint32_t checkMs = HEAP_CHECK_MS);
+        void check();
+        boolean isLow();
+        uint8_t getFragmentation();
+        void enter(uint32_t *free, uint32_t *block, int32_t *outer);
+        void leave(HeapSiteId site, uint32_t free, uint32_t block, int32_t outer);
+        const HeapSiteStats *getSite(HeapSiteId site);
+        HeapSiteId getWorstSite();
+        void report(JsonObject json);
+        void print();
+    private:
+        static void checkJob();
+        HeapSiteStats _sites[HEAP_SITE_COUNT];
+        uint32_t _free;
+        uint32_t _largest;
+        uint32_t _minimum;
+        boolean _low;
+        int32_t _inner;                 // Left allocated by the sites that have closed inside the open one
+};
+
+// Scope that charges a site with what it allocates and does not free i.e.
+//   HeapSite site(HEAP_SITE_DELTA);
+// Only the loop task's own allocations should happen in the scope, anything another task
+// does at the same time is charged to it as well.
+class HeapSite
+{
+    public:
+        HeapSite(HeapSiteId site);
+        ~HeapSite();
+    private:
+        HeapSiteId _site;
+        uint32_t _free;
+        uint32_t _block;
+        int32_t _outer;                 // The enclosing site's inner count while this one is open
+};
+
+extern HeapMonitorClass HeapMonitor;
+
+#endif
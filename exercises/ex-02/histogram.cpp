@@ -0,0 +1,136 @@
+#include "histogram.h"
+
+// One character per bucket, more ink for more values
+static const char HISTOGRAM_LEVELS[] = " .:-=+*#%@";
+
+// Constructor
+HistogramClass::HistogramClass()
+{
+    this->clear();
+}
+
+// Which bucket a duration goes in
+uint8_t IRAM_ATTR HistogramClass::bucketOf(uint32_t us)
+{
+    uint8_t bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+    return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+// Count a duration
+void HistogramClass::add(uint32_t us)
+{
+    this->_buckets[bucketOf(us)]++;
+    this->_count++;
+    this->_total += us;
+    if (us > this->_max)
+    {
+        this->_max = us;
+    }
+}
+
+// Start again
+void HistogramClass::clear()
+{
+    memset(this->_buckets, 0, sizeof(this->_buckets));
+    this->_count = 0;
+    this->_max = 0;
+    this->_total = 0;
+}
+
+// Take the counts from elsewhere i.e. the difference between two metrics snapshots.
+// The total is not known so the mean is lost.
+void HistogramClass::load(const uint32_t *buckets, uint32_t max)
+{
+    memcpy(this->_buckets, buckets, sizeof(this->_buckets));
+    this->_count = 0;
+    for (uint8_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        this->_count += buckets[i];
+    }
+    this->_max = max;
+    this->_total = 0;
+}
+
+// How many durations have been counted
+uint32_t HistogramClass::getCount()
+{
+    return this->_count;
+}
+
+// Longest duration counted
+uint32_t HistogramClass::getMax()
+{
+    return this->_max;
+}
+
+// Sum of the durations, for the mean
+uint64_t HistogramClass::getTotal()
+{
+    return this->_total;
+}
+
+// Count in one bucket
+uint32_t HistogramClass::getBucket(uint8_t bucket)
+{
+    return bucket < HISTOGRAM_BUCKETS ? this->_buckets[bucket] : 0;
+}
+
+// Upper bound of the bucket the percentile falls in, the real max for the last bucket
+uint32_t HistogramClass::percentile(uint8_t pct)
+{
+    if (this->_count == 0)
+    {
+        return 0;
+    }
+    uint32_t wanted = ((uint64_t)this->_count * pct + 99) / 100;
+    uint32_t seen = 0;
+    for (uint8_t i = 0; i < HISTOGRAM_BUCKETS - 1; i++)
+    {
+        seen += this->_buckets[i];
+        if (seen >= wanted)
+        {
+            return min(i == 0 ? 0 : (1UL << i) - 1, (unsigned long)this->_max);
+        }
+    }
+    return this->_max;
+}
+
+// The buckets as a row of characters, enough to see the shape on the LCD or in a log
+void HistogramClass::shape(char *buffer, size_t size)
+{
+    uint32_t peak = 0;
+    for (uint8_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        peak = max(peak, this->_buckets[i]);
+    }
+    uint8_t length = min(size - 1, (size_t)HISTOGRAM_BUCKETS);
+    for (uint8_t i = 0; i < length; i++)
+    {
+        uint32_t count = this->_buckets[i];
+        buffer[i] = HISTOGRAM_LEVELS[count == 0 ? 0 : 1 + (uint64_t)count * (sizeof(HISTOGRAM_LEVELS) - 3) / peak];
+    }
+    buffer[length] = '\0';
+}
+
+// Count, p50, p99 and max as a compact array
+void HistogramClass::summary(JsonArray json)
+{
+    json.add(this->_count);
+    json.add(this->percentile(50));
+    json.add(this->percentile(99));
+    json.add(this->_max);
+}
+
+// Count in each bucket up to the last one used
+void HistogramClass::buckets(JsonArray json)
+{
+    int8_t last = HISTOGRAM_BUCKETS - 1;
+    while (last >= 0 && this->_buckets[last] == 0)
+    {
+        last--;
+    }
+    for (int8_t i = 0; i <= last; i++)
+    {
+        json.add(this->_buckets[i]);
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+const uint8_t HISTOGRAM_BUCKETS = 20;       // Powers of two up to 2^18, the last bucket takes the rest
+const uint8_t HISTOGRAM_SHAPE_SIZE = HISTOGRAM_BUCKETS + 1;
+
+// Fixed bucket log scale histogram of durations in microseconds.  Bucket 0 is 0us and bucket
+// n holds [2^(n-1), 2^n) so adding a value is a count leading zeros and an increment, there
+// is nothing to allocate and it is the same size however many values go in.
+class HistogramClass
+{
+    public:
+        HistogramClass();
+        static uint8_t bucketOf(uint32_t us);
+        void add(uint32_t us);
+        void load(const uint32_t *buckets, uint32_t max);
+        void clear();
+        uint32_t getCount();
+        uint32_t getMax();
+        uint64_t getTotal();
+        uint32_t getBucket(uint8_t bucket);
+        uint32_t percentile(uint8_t pct);
+        void shape(char *buffer, size_t size);
+        void summary(JsonArray json);
+        void buckets(JsonArray json);
+    private:
+        uint32_t _buckets[HISTOGRAM_BUCKETS];
+        uint32_t _count;
+        uint32_t _max;
+        uint64_t _total;
+};
+
+#endif
@@ -0,0 +1,220 @@
+#include "hot-path-bench.h"
+#include <ArduinoJson.h>
+#include <SPIFFS.h>
+#include "cloud.h"
+#include "aws-iot.h"
+#include "loopback-transport.h"
+#include "device-config.h"
+#include "ntp-utility.h"
+
+// Shadow deltas as AWS sends them.  The values alternate so every other pass is a change
+// that gets accepted and the rest are no-ops, like a real device sees.
+static const char *const HOT_BENCH_DELTAS[] = {
+    "{\"version\":101,\"timestamp\":1571500800,\"state\":{\"send_interval\":15000},"
+        "\"metadata\":{\"send_interval\":{\"timestamp\":1571500800}}}",
+    "{\"version\":102,\"timestamp\":1571500860,\"state\":{\"location\":{\"room\":\"Kitchen\"}},"
+        "\"metadata\":{\"location\":{\"room\":{\"timestamp\":1571500860}}}}",
+    "{\"version\":103,\"timestamp\":1571500920,\"state\":{\"lcd\":true,\"device\":\"Off\"},"
+        "\"metadata\":{\"lcd\":{\"timestamp\":1571500920},\"device\":{\"timestamp\":1571500920}}}",
+    "{\"version\":104,\"timestamp\":1571500980,\"state\":{\"send_interval\":10000,\"send_enabled\":true},"
+        "\"metadata\":{\"send_interval\":{\"timestamp\":1571500980},\"send_enabled\":{\"timestamp\":1571500980}}}",
+    "{\"version\":105,\"timestamp\":1571501040,\"state\":{\"location\":{\"room\":\"Office\"}},"
+        "\"metadata\":{\"location\":{\"room\":{\"timestamp\":1571501040}}}}"
+};
+static const uint8_t HOT_BENCH_DELTA_COUNT = sizeof(HOT_BENCH_DELTAS) / sizeof(HOT_BENCH_DELTAS[0]);
+
+static sensorsClass *benchSensors;
+static TWINUPDATECALLBACK benchTwinCallback;
+static JOBCALLBACK benchBuildAndSend;
+static char benchBuffer[512];
+static StaticJsonDocument<512> benchDoc;
+
+static void benchToJson(uint32_t iteration)
+{
+    benchSensors->toJson();
+}
+
+static void benchISO8601(uint32_t iteration)
+{
+    NTPUtility.getISO8601Formatted(benchBuffer, sizeof(benchBuffer));
+}
+
+static void benchFormattedDate(uint32_t iteration)
+{
+    NTPUtility.getFormattedDate(benchBuffer, sizeof(benchBuffer));
+}
+
+// The String based date code ntp-utility had before the dates were worked out in constant
+// time, kept here to compare against.  Its year loop gets longer every year since 1970 so it
+// is run a day at a time from a 2019 epoch rather than from the bench's unsynced clock.
+#define LEGACY_LEAP_YEAR(Y)     ( (Y>0) && !(Y%4) && ( (Y%100) || !(Y%400) ) )
+static const unsigned long LEGACY_EPOCH = 1571500800;
+
+static String legacyFormattedDate(unsigned long epoch)
+{
+    unsigned long rawTime = epoch / 86400L;  // in days
+    unsigned long days = 0, year = 1970;
+    uint8_t month;
+    static const uint8_t monthDays[]={31,28,31,30,31,30,31,31,30,31,30,31};
+
+    while((days += (LEGACY_LEAP_YEAR(year) ? 366 : 365)) <= rawTime)
+        year++;
+
+    rawTime -= days - (LEGACY_LEAP_YEAR(year) ? 366 : 365); // now it is days in this year, starting at 0
+    days=0;
+    for (month=0; month<12; month++) {
+        uint8_t monthLength;
+        if (month==1)
+        {
+            monthLength = LEGACY_LEAP_YEAR(year) ? 29 : 28;
+        } else {
+            monthLength = monthDays[month];
+        }
+        if (rawTime < monthLength) break;
+        rawTime -= monthLength;
+    }
+    String monthStr = ++month < 10 ? "0" + String(month) : String(month); // jan is month 1
+    String dayStr = ++rawTime < 10 ? "0" + String(rawTime) : String(rawTime); // day of month
+    return String(year) + "-" + monthStr + "-" + dayStr;
+}
+
+// NTPClient::getFormattedTime as it was called by the old getISO8601Formatted
+static String legacyFormattedTime(unsigned long epoch)
+{
+    unsigned long hours = (epoch % 86400L) / 3600;
+    String hoursStr = hours < 10 ? "0" + String(hours) : String(hours);
+    unsigned long minutes = (epoch % 3600) / 60;
+    String minuteStr = minutes < 10 ? "0" + String(minutes) : String(minutes);
+    unsigned long seconds = epoch % 60;
+    String secondStr = seconds < 10 ? "0" + String(seconds) : String(seconds);
+    return hoursStr + ":" + minuteStr + ":" + secondStr;
+}
+
+static void benchLegacyISO8601(uint32_t iteration)
+{
+    unsigned long epoch = LEGACY_EPOCH + iteration * 86400UL;
+    String date = legacyFormattedDate(epoch);
+    String iso = date + String("T") + legacyFormattedTime(epoch) + "Z";
+}
+
+static void benchLegacyFormattedDate(uint32_t iteration)
+{
+    legacyFormattedDate(LEGACY_EPOCH + iteration * 86400UL);
+}
+
+// desiredUpdate parses in place so each pass gets its own copy of the delta
+static void benchDesiredUpdate(uint32_t iteration)
+{
+    const char *delta = HOT_BENCH_DELTAS[iteration % HOT_BENCH_DELTA_COUNT];
+    size_t length = strlcpy(benchBuffer, delta, sizeof(benchBuffer));
+    Cloud.desiredUpdate((byte *)benchBuffer, length);
+}
+
+// The application's half of a delta, parsing it is part of the cost as desiredUpdate does it too
+static void benchTwinCallbackCase(uint32_t iteration)
+{
+    deserializeJson(benchDoc, HOT_BENCH_DELTAS[iteration % HOT_BENCH_DELTA_COUNT]);
+    benchTwinCallback(benchDoc["state"].as<JsonObject>());
+}
+
+static void benchReadFile(uint32_t iteration)
+{
+    AWSIoT.readFile(DeviceConfig.getDeviceCertName());
+}
+
+static void benchBuildMessage(uint32_t iteration)
+{
+    benchBuildAndSend();
+}
+
+// Constructor
+HotPathBenchClass::HotPathBenchClass()
+    : _count(0)
+{
+}
+
+void HotPathBenchClass::add(const char *name, BENCHCASE bench)
+{
+    if (this->_count < HOT_BENCH_MAX_CASES)
+    {
+        this->_names[this->_count] = name;
+        this->_cases[this->_count++] = bench;
+    }
+}
+
+// Run one case with more and more iterations until it takes long enough to time and print it
+void HotPathBenchClass::measure(const char *name, BENCHCASE bench)
+{
+    bench(0);   // Warm up, the first call can allocate things that stay around
+    uint32_t iterations = 1;
+    uint32_t elapsed = 0;
+    int32_t retained = 0;
+    for (;;)
+    {
+        uint32_t freeBefore = ESP.getFreeHeap();
+        uint32_t start = micros();
+        for (uint32_t i = 0; i < iterations; i++)
+        {
+            bench(i);
+        }
+        elapsed = micros() - start;
+        retained = (int32_t)(freeBefore - ESP.getFreeHeap());
+        if (elapsed >= HOT_BENCH_MIN_US || iterations >= HOT_BENCH_MAX_ITERATIONS)
+        {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    StaticJsonDocument<256> result;
+    result["bench"] = "hot-path";
+    result["name"] = name;
+    result["iterations"] = iterations;
+    result["ns_per_op"] = (uint32_t)((uint64_t)elapsed * 1000 / iterations);
+    result["heap_bytes_per_op"] = (float)retained / iterations;
+    result["largest_block"] = ESP.getMaxAllocHeap();
+    serializeJson(result, Serial);
+    Serial.println();
+}
+
+// Run every case against the loopback transport.  Must be called instead of the normal
+// connection as Cloud is left on the loopback transport.
+void HotPathBenchClass::run(sensorsClass *sensors, TWINUPDATECALLBACK twinCallback, JOBCALLBACK buildAndSend)
+{
+    benchSensors = sensors;
+    benchTwinCallback = twinCallback;
+    benchBuildAndSend = buildAndSend;
+
+    // Lift the rate limits so the results are for the code and not the token buckets
+    for (uint8_t lane = 0; lane < LANE_COUNT; lane++)
+    {
+        PublishScheduler.setLimit((PublishLane)lane, 60000, 255);
+    }
+    SPIFFS.begin(true);
+    Cloud.begin(&LoopbackTransport, twinCallback);
+    Cloud.connect();
+
+    this->add("toJson", benchToJson);
+    this->add("getISO8601Formatted", benchISO8601);
+    this->add("getFormattedDate", benchFormattedDate);
+    this->add("getISO8601Formatted/legacy", benchLegacyISO8601);
+    this->add("getFormattedDate/legacy", benchLegacyFormattedDate);
+    this->add("desiredUpdate", benchDesiredUpdate);
+    this->add("digitalTwinCallback", benchTwinCallbackCase);
+    this->add("readFile", benchReadFile);
+    this->add("buildMessageAndSend", benchBuildMessage);
+
+    StaticJsonDocument<192> context;
+    context["bench"] = "hot-path";
+    context["cpu_mhz"] = ESP.getCpuFreqMHz();
+    context["free_heap"] = ESP.getFreeHeap();
+    context["deltas"] = HOT_BENCH_DELTA_COUNT;
+    serializeJson(context, Serial);
+    Serial.println();
+    for (uint8_t i = 0; i < this->_count; i++)
+    {
+        this->measure(this->_names[i], this->_cases[i]);
+    }
+}
+
+HotPathBenchClass HotPathBench;
@@ -0,0 +1,34 @@
+#ifndef HOT_PATH_BENCH_H
+#define HOT_PATH_BENCH_H
+
+#include <Arduino.h>
+#include "callbacks.h"
+#include "sensors.h"
+
+const uint32_t HOT_BENCH_MIN_US = 500000;       // Keep doubling the iterations until a case runs this long
+const uint32_t HOT_BENCH_MAX_ITERATIONS = 65536;
+const uint8_t HOT_BENCH_MAX_CASES = 10;
+
+typedef void (*BENCHCASE)(uint32_t iteration);
+
+// Times the firmware hot paths on the device against the loopback transport and prints one
+// JSON line per case on the serial port, in the spirit of Google Benchmark: the iterations
+// double until the case has run for HOT_BENCH_MIN_US, then the time per op and the heap it
+// left allocated per op are reported.  The paths print to the serial port as they do in
+// normal running and that is part of what they cost, grep the output for "hot-path".
+class HotPathBenchClass
+{
+    public:
+        HotPathBenchClass();
+        void run(sensorsClass *sensors, TWINUPDATECALLBACK twinCallback, JOBCALLBACK buildAndSend);
+    private:
+        void add(const char *name, BENCHCASE bench);
+        void measure(const char *name, BENCHCASE bench);
+        const char *_names[HOT_BENCH_MAX_CASES];
+        BENCHCASE _cases[HOT_BENCH_MAX_CASES];
+        uint8_t _count;
+};
+
+extern HotPathBenchClass HotPathBench;
+
+#endif
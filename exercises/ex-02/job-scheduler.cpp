@@ -0,0 +1,273 @@
+#include "job-scheduler.h"
+
+// Constructor
+JobSchedulerClass::JobSchedulerClass()
+    : _count(0), _armed(0)
+{
+    memset(this->_jobs, 0, sizeof(this->_jobs));
+}
+
+// Run callback every periodMs, the first run is one period from now
+int8_t JobSchedulerClass::every(const char *name, uint32_t periodMs, JOBCALLBACK callback, JobPriority priority)
+{
+    int8_t id = this->create(name, periodMs, callback, priority);
+    if (id != NO_JOB)
+    {
+        this->schedule(id, periodMs);
+    }
+    return id;
+}
+
+// Run callback once after delayMs, schedule() arms it again
+int8_t JobSchedulerClass::once(const char *name, uint32_t delayMs, JOBCALLBACK callback, JobPriority priority)
+{
+    int8_t id = this->create(name, 0, callback, priority);
+    if (id != NO_JOB)
+    {
+        this->schedule(id, delayMs);
+    }
+    return id;
+}
+
+// Register a one-shot that waits for schedule() to arm it
+int8_t JobSchedulerClass::add(const char *name, JOBCALLBACK callback, JobPriority priority)
+{
+    return this->create(name, 0, callback, priority);
+}
+
+// Register a job without arming it
+int8_t JobSchedulerClass::create(const char *name, uint32_t periodMs, JOBCALLBACK callback, JobPriority priority)
+{
+    if (this->_count >= SCHEDULER_MAX_JOBS || callback == NULL)
+    {
+        // The job will never run, make sure that gets noticed
+        if (callback == NULL)
+        {
+            Serial.printf("*** Job %s has no callback, it will never run ***\r\n", name);
+        }
+        else
+        {
+            Serial.printf("*** No room for job %s, it will never run, raise SCHEDULER_MAX_JOBS (%u) ***\r\n", name, SCHEDULER_MAX_JOBS);
+        }
+        Metrics.increment(METRIC_JOBS_REJECTED);
+        return NO_JOB;
+    }
+    int8_t id = this->_count++;
+    Job *job = &this->_jobs[id];
+    job->name = name;
+    job->callback = callback;
+    job->priority = priority;
+    job->period_ms = periodMs;
+    job->heap = NO_JOB;
+    return id;
+}
+
+// Run the job delayMs from now instead of whenever it was due, arming it if it was not
+void JobSchedulerClass::schedule(int8_t id, uint32_t delayMs)
+{
+    if (id < 0 || id >= this->_count)
+    {
+        return;
+    }
+    this->arm(id, esp_timer_get_time() + (int64_t)delayMs * 1000);
+}
+
+// Change how often a periodic job runs, takes effect from its next run
+void JobSchedulerClass::setPeriod(int8_t id, uint32_t periodMs)
+{
+    if (id >= 0 && id < this->_count && this->_jobs[id].period_ms > 0 && periodMs > 0)
+    {
+        this->_jobs[id].period_ms = periodMs;
+    }
+}
+
+// Take the job out of the heap, it stays registered
+void JobSchedulerClass::cancel(int8_t id)
+{
+    if (id >= 0 && id < this->_count && this->_jobs[id].heap != NO_JOB)
+    {
+        this->remove(this->_jobs[id].heap);
+    }
+}
+
+// Is the job waiting to run
+boolean JobSchedulerClass::isArmed(int8_t id)
+{
+    return id >= 0 && id < this->_count && this->_jobs[id].heap != NO_JOB;
+}
+
+// Set the due time and put the job where it now belongs in the heap
+void JobSchedulerClass::arm(int8_t id, int64_t dueUs)
+{
+    Job *job = &this->_jobs[id];
+    job->due_us = dueUs;
+    if (job->heap == NO_JOB)
+    {
+        this->place(this->_armed++, id);
+    }
+    this->siftUp(job->heap);
+    this->siftDown(job->heap);
+}
+
+// Run the jobs that are due, earliest first.  A periodic job is put back before its callback
+// runs so the callback can move or cancel it.  Returns how many ran.
+uint8_t JobSchedulerClass::run()
+{
+    uint8_t ran = 0;
+    int64_t now = esp_timer_get_time();
+    // Bounded so a job that keeps making itself due cannot hold the loop
+    while (this->_armed > 0 && this->_jobs[this->_heap[0]].due_us <= now && ran < SCHEDULER_MAX_JOBS)
+    {
+        int8_t id = this->_heap[0];
+        Job *job = &this->_jobs[id];
+        uint32_t late = now - job->due_us;
+        boolean overrun = false;
+        if (job->period_ms > 0)
+        {
+            int64_t period = (int64_t)job->period_ms * 1000;
+            int64_t next = job->due_us + period;
+            if (next <= now)
+            {
+                // Missed at least one whole period, start the cadence again from now
+                overrun = true;
+                next = now + period;
+            }
+            this->arm(id, next);
+        }
+        else
+        {
+            this->remove(0);
+        }
+
+        job->callback();
+
+        int64_t end = esp_timer_get_time();
+        uint32_t took = end - now;
+        if (job->period_ms > 0 && took > job->period_ms * 1000)
+        {
+            overrun = true;
+        }
+        job->runs++;
+        job->total_late_us += late;
+        job->max_late_us = max(job->max_late_us, late);
+        job->max_run_us = max(job->max_run_us, took);
+        if (overrun)
+        {
+            job->overruns++;
+        }
+        ran++;
+        now = end;
+    }
+    if (this->_armed > 0)
+    {
+        int64_t wait = this->_jobs[this->_heap[0]].due_us - now;
+        WakeScheduler.after(wait > 0 ? (wait + 999) / 1000 : 0);
+    }
+    return ran;
+}
+
+// How many jobs are registered
+uint8_t JobSchedulerClass::getCount()
+{
+    return this->_count;
+}
+
+// A job and its statistics
+const Job *JobSchedulerClass::getJob(int8_t id)
+{
+    if (id < 0 || id >= this->_count)
+    {
+        return NULL;
+    }
+    return &this->_jobs[id];
+}
+
+// Runs, overruns and jitter for each job keyed by its name
+void JobSchedulerClass::report(JsonObject json)
+{
+    for (uint8_t i = 0; i < this->_count; i++)
+    {
+        const Job *job = &this->_jobs[i];
+        JsonObject stats = json.createNestedObject(job->name);
+        stats["runs"] = job->runs;
+        stats["overruns"] = job->overruns;
+        stats["late_max_us"] = job->max_late_us;
+        stats["late_avg_us"] = job->runs > 0 ? (uint32_t)(job->total_late_us / job->runs) : 0;
+        stats["run_max_us"] = job->max_run_us;
+    }
+}
+
+// Heap order, sooner due first and the higher priority when they are due together
+boolean JobSchedulerClass::earlier(int8_t a, int8_t b)
+{
+    const Job *first = &this->_jobs[a];
+    const Job *second = &this->_jobs[b];
+    if (first->due_us != second->due_us)
+    {
+        return first->due_us < second->due_us;
+    }
+    return first->priority > second->priority;
+}
+
+// Put a job in a heap slot and remember where it is
+void JobSchedulerClass::place(uint8_t pos, int8_t id)
+{
+    this->_heap[pos] = id;
+    this->_jobs[id].heap = pos;
+}
+
+void JobSchedulerClass::siftUp(uint8_t pos)
+{
+    int8_t id = this->_heap[pos];
+    while (pos > 0)
+    {
+        uint8_t parent = (pos - 1) / 2;
+        if (!this->earlier(id, this->_heap[parent]))
+        {
+            break;
+        }
+        this->place(pos, this->_heap[parent]);
+        pos = parent;
+    }
+    this->place(pos, id);
+}
+
+void JobSchedulerClass::siftDown(uint8_t pos)
+{
+    int8_t id = this->_heap[pos];
+    while (true)
+    {
+        uint8_t child = pos * 2 + 1;
+        if (child >= this->_armed)
+        {
+            break;
+        }
+        if (child + 1 < this->_armed && this->earlier(this->_heap[child + 1], this->_heap[child]))
+        {
+            child++;
+        }
+        if (!this->earlier(this->_heap[child], id))
+        {
+            break;
+        }
+        this->place(pos, this->_heap[child]);
+        pos = child;
+    }
+    this->place(pos, id);
+}
+
+// Take a slot out of the heap, the last job fills the gap and moves to where it belongs
+void JobSchedulerClass::remove(uint8_t pos)
+{
+    this->_jobs[this->_heap[pos]].heap = NO_JOB;
+    this->_armed--;
+    if (pos < this->_armed)
+    {
+        int8_t last = this->_heap[this->_armed];
+        this->place(pos, last);
+        this->siftUp(pos);
+        this->siftDown(this->_jobs[last].heap);
+    }
+}
+
+JobSchedulerClass Scheduler;
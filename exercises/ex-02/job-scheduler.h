@@ -0,0 +1,70 @@
+#ifndef JOB_SCHEDULER_H
+#define JOB_SCHEDULER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "esp_timer.h"
+#include "callbacks.h"
+#include "wake-scheduler.h"
+#include "metrics.h"
+
+const uint8_t SCHEDULER_MAX_JOBS = 16;        // ex-02 registers 12 with the profiling probes on, keep some spare
+const int8_t NO_JOB = -1;
+
+typedef enum {
+    JOB_LOW,
+    JOB_NORMAL,
+    JOB_HIGH
+} JobPriority;
+
+typedef struct {
+    const char *name;
+    JOBCALLBACK callback;
+    JobPriority priority;       // Which goes first when jobs fall due together
+    uint32_t period_ms;         // 0 for a one-shot, it stays registered and can be armed again
+    int64_t due_us;             // esp_timer time the job should run
+    int8_t heap;                // Where it is in the heap, NO_JOB when not armed
+    uint32_t runs;
+    uint32_t overruns;          // Runs that missed a whole period or took longer than one
+    uint32_t max_late_us;       // Jitter, how far after the due time a run started
+    uint64_t total_late_us;
+    uint32_t max_run_us;
+} Job;
+
+// One place for everything that happens on a timer, sampling, publishing, the NTP sync, the
+// LCD sleep and the transport keepalive.  The armed jobs sit in a binary min-heap ordered by
+// due time then priority, so run() only looks at the top and reschedule is O(log n).  Periodic
+// jobs keep to their own cadence rather than drifting by however late they ran.  After each
+// run() the next due time goes to the WakeScheduler so the loop sleeps until then.
+class JobSchedulerClass
+{
+    public:
+        JobSchedulerClass();
+        int8_t every(const char *name, uint32_t periodMs, JOBCALLBACK callback, JobPriority priority = JOB_NORMAL);
+        int8_t once(const char *name, uint32_t delayMs, JOBCALLBACK callback, JobPriority priority = JOB_NORMAL);
+        int8_t add(const char *name, JOBCALLBACK callback, JobPriority priority = JOB_NORMAL);
+        void schedule(int8_t id, uint32_t delayMs);
+        void setPeriod(int8_t id, uint32_t periodMs);
+        void cancel(int8_t id);
+        boolean isArmed(int8_t id);
+        uint8_t run();
+        uint8_t getCount();
+        const Job *getJob(int8_t id);
+        void report(JsonObject json);
+    private:
+        int8_t create(const char *name, uint32_t periodMs, JOBCALLBACK callback, JobPriority priority);
+        void arm(int8_t id, int64_t dueUs);
+        boolean earlier(int8_t a, int8_t b);
+        void place(uint8_t pos, int8_t id);
+        void siftUp(uint8_t pos);
+        void siftDown(uint8_t pos);
+        void remove(uint8_t pos);
+        Job _jobs[SCHEDULER_MAX_JOBS];
+        int8_t _heap[SCHEDULER_MAX_JOBS];
+        uint8_t _count;                 // Jobs registered
+        uint8_t _armed;                 // Jobs in the heap
+};
+
+extern JobSchedulerClass Scheduler;
+
+#endif
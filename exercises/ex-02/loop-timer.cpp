@@ -0,0 +1,120 @@
+#include "loop-timer.h"
+
+static const char *const LOOP_PHASE_NAMES[LOOP_PHASE_COUNT] = {
+    "jobs", "events", "debounce", "clock", "cloud", "status", "display", "pass", "wait"
+};
+
+// The names padded to line the columns up on the diagnostics page
+static const char *const LOOP_PHASE_LABELS[LOOP_PHASE_COUNT] = {
+    "jobs     ", "events   ", "debounce ", "clock    ", "cloud    ", "status   ", "display  ", "pass     ", "wait     "
+};
+
+// Constructor
+LoopTimerClass::LoopTimerClass()
+    : _pass_start(0), _mark(0), _header_field(NO_FIELD), _since(0)
+{
+    for (uint8_t i = 0; i < LOOP_PHASE_COUNT; i++)
+    {
+        this->_fields[i] = NO_FIELD;
+    }
+}
+
+// Put a row for each phase on the diagnostics page
+void LoopTimerClass::begin()
+{
+    this->_header_field = Display.addField("Loop us  ", 0, 0, LOOP_FIELD_WIDTH, DISPLAY_DIAGNOSTICS_PAGE);
+    Display.setText(this->_header_field, "   p50    p99    max  1us..256ms+");
+    for (uint8_t i = 0; i < LOOP_PHASE_COUNT; i++)
+    {
+        this->_fields[i] = Display.addField(LOOP_PHASE_LABELS[i], 0, 16 + i * 12, LOOP_FIELD_WIDTH, DISPLAY_DIAGNOSTICS_PAGE);
+    }
+    this->_since = millis();
+}
+
+// Top of the pass
+void LoopTimerClass::start()
+{
+    this->_pass_start = esp_timer_get_time();
+    this->_mark = this->_pass_start;
+}
+
+// The phase that has just finished
+void LoopTimerClass::mark(LoopPhase phase)
+{
+    int64_t now = esp_timer_get_time();
+    this->_phases[phase].add(now - this->_mark);
+    this->_mark = now;
+}
+
+// End of the work in the pass, what follows until the next start() is the wait
+void LoopTimerClass::finish()
+{
+    int64_t now = esp_timer_get_time();
+    this->_phases[PHASE_PASS].add(now - this->_pass_start);
+    this->_mark = now;
+}
+
+// A time in exactly LOOP_COLUMN_WIDTH characters, the wait runs to a second and more
+static void formatColumn(char *buffer, size_t size, uint32_t us)
+{
+    if (us < 1000000)
+    {
+        snprintf(buffer, size, "%6u", us);
+    }
+    else if (us < 100000000)
+    {
+        snprintf(buffer, size, "%5um", us / 1000);
+    }
+    else
+    {
+        snprintf(buffer, size, "%5us", us / 1000000);
+    }
+}
+
+// Refresh the diagnostics page
+void LoopTimerClass::show()
+{
+    char shape[HISTOGRAM_SHAPE_SIZE];
+    char p50[LOOP_COLUMN_WIDTH + 1];
+    char p99[LOOP_COLUMN_WIDTH + 1];
+    char highest[LOOP_COLUMN_WIDTH + 1];
+    for (uint8_t i = 0; i < LOOP_PHASE_COUNT; i++)
+    {
+        HistogramClass *histogram = &this->_phases[i];
+        histogram->shape(shape, sizeof(shape));
+        formatColumn(p50, sizeof(p50), histogram->percentile(50));
+        formatColumn(p99, sizeof(p99), histogram->percentile(99));
+        formatColumn(highest, sizeof(highest), histogram->getMax());
+        Display.printf(this->_fields[i], "%s %s %s  %s", p50, p99, highest, shape);
+    }
+}
+
+// Every phase's [count, p50, p99, max] since the last clear and the buckets of the whole pass.
+// All the buckets of every phase would not fit in CLOUD_MAX_PAYLOAD, the LCD page shows them.
+void LoopTimerClass::report(JsonObject json)
+{
+    json["period_ms"] = millis() - this->_since;
+    for (uint8_t i = 0; i < LOOP_PHASE_COUNT; i++)
+    {
+        this->_phases[i].summary(json.createNestedArray(LOOP_PHASE_NAMES[i]));
+    }
+    this->_phases[PHASE_PASS].buckets(json.createNestedArray("pass_buckets"));
+}
+
+// Start the histograms again, after they have been published
+void LoopTimerClass::clear()
+{
+    for (uint8_t i = 0; i < LOOP_PHASE_COUNT; i++)
+    {
+        this->_phases[i].clear();
+    }
+    this->_since = millis();
+}
+
+// One phase's histogram
+HistogramClass *LoopTimerClass::getHistogram(LoopPhase phase)
+{
+    return &this->_phases[phase];
+}
+
+LoopTimerClass LoopTimer;
@@ -0,0 +1,61 @@
+#ifndef LOOP_TIMER_H
+#define LOOP_TIMER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "esp_timer.h"
+#include "histogram.h"
+#include "display.h"
+
+const uint32_t LOOP_SHOW_MS = 1000;         // How often the diagnostics page is refreshed
+const uint32_t LOOP_REPORT_MS = 300000;     // How often the histograms are published
+const uint8_t LOOP_COLUMN_WIDTH = 6;        // us up to 999999, then ms with an m or seconds with an s
+const uint8_t LOOP_FIELD_WIDTH = 3 * (LOOP_COLUMN_WIDTH + 1) + 1 + HISTOGRAM_BUCKETS;  // p50 p99 max, a gap and the shape
+
+typedef enum {
+    PHASE_JOBS,         // Scheduler jobs, sampling, publishing, NTP, keepalive
+    PHASE_EVENTS,       // ISR events to their handlers
+    PHASE_DEBOUNCE,
+    PHASE_CLOCK,        // ISO time for the display
+    PHASE_CLOUD,        // Occupancy and inbound messages
+    PHASE_STATUS,       // Sensor values for the display
+    PHASE_DISPLAY,      // LCD state and handing the snapshot over
+    PHASE_PASS,         // The whole pass less the wait
+    PHASE_WAIT,         // Time blocked in the WakeScheduler
+    LOOP_PHASE_COUNT
+} LoopPhase;
+
+// JSON document for a report: the root with loop and the msg_number, timestamp and trace sendMessage
+// adds, period_ms, a [count, p50, p99, max] per phase and pass_buckets.  The text still has to fit
+// in CLOUD_MAX_PAYLOAD.
+const uint16_t LOOP_DOC_SIZE = JSON_OBJECT_SIZE(4) + JSON_OBJECT_SIZE(LOOP_PHASE_COUNT + 2)
+    + LOOP_PHASE_COUNT * JSON_ARRAY_SIZE(4) + JSON_ARRAY_SIZE(HISTOGRAM_BUCKETS);
+
+// Phase timers for loop().  start() at the top of the pass, mark() after each phase adds the
+// time since the previous mark to that phase's histogram, so each phase costs one
+// esp_timer_get_time() and a bucket increment.  The histograms are shown on the diagnostics
+// page of the display and reported for publishing.
+class LoopTimerClass
+{
+    public:
+        LoopTimerClass();
+        void begin();
+        void start();
+        void mark(LoopPhase phase);
+        void finish();
+        void show();
+        void report(JsonObject json);
+        void clear();
+        HistogramClass *getHistogram(LoopPhase phase);
+    private:
+        HistogramClass _phases[LOOP_PHASE_COUNT];
+        int64_t _pass_start;
+        int64_t _mark;
+        int8_t _fields[LOOP_PHASE_COUNT];
+        int8_t _header_field;
+        uint32_t _since;                // millis() the histograms were last cleared
+};
+
+extern LoopTimerClass LoopTimer;
+
+#endif
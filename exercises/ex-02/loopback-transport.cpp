@@ -0,0 +1,173 @@
+#include "loopback-transport.h"
+#include "cloud.h"
+#include "trace.h"
+
+// Constructor
+LoopbackTransportClass::LoopbackTransportClass()
+    : _connected(false), _hook(NULL), _telemetry_count(0), _shadow_count(0), _bytes(0), _head(0), _tail(0)
+{
+    this->_mux = portMUX_INITIALIZER_UNLOCKED;
+}
+
+// Name of the transport
+const char *LoopbackTransportClass::getName()
+{
+    return "Loopback";
+}
+
+// Nothing to load, just reset the counters
+void LoopbackTransportClass::begin()
+{
+    this->_telemetry_count = 0;
+    this->_shadow_count = 0;
+    this->_bytes = 0;
+    this->_head = this->_tail = 0;
+}
+
+// Always connects
+boolean LoopbackTransportClass::connect()
+{
+    this->_connected = true;
+    return true;
+}
+
+boolean LoopbackTransportClass::isConnected()
+{
+    return this->_connected;
+}
+
+// Count the message and pass it to the hook if there is one
+boolean LoopbackTransportClass::publishNow(TopicType topic, const char *payload)
+{
+    if (!this->_connected)
+    {
+        return false;
+    }
+    if (topic == SHADOW_TOPIC)
+    {
+        this->_shadow_count++;
+        Trace.ack(payload, strlen(payload));    // The stand-in shadow accepts everything straight away
+    }
+    else
+    {
+        this->_telemetry_count++;
+    }
+    this->_bytes += strlen(payload);
+    if (this->_hook != NULL)
+    {
+        this->_hook(topic, payload);
+    }
+    return true;
+}
+
+// Deliver one injected delta/method, the same as a real transport would from its receive callback
+void LoopbackTransportClass::poll()
+{
+    InboundMessage msg;
+    boolean found = false;
+    portENTER_CRITICAL(&this->_mux);
+    if (this->_tail != this->_head)
+    {
+        msg = this->_pending[this->_tail];
+        this->_tail = (this->_tail + 1) % LOOPBACK_DEPTH;
+        found = true;
+    }
+    portEXIT_CRITICAL(&this->_mux);
+
+    if (found)
+    {
+        Cloud.received(msg.type, msg.name, (byte *)msg.payload, msg.length);
+    }
+}
+
+// Queue a shadow delta document i.e. {"state":{"send_interval":10000}}
+boolean LoopbackTransportClass::injectDelta(const char *payload)
+{
+    return this->inject(DELTA_INBOUND, "", payload);
+}
+
+// Queue a direct method call
+boolean LoopbackTransportClass::injectMethod(const char *method, const char *payload)
+{
+    return this->inject(METHOD_INBOUND, method, payload);
+}
+
+boolean LoopbackTransportClass::inject(InboundType type, const char *name, const char *payload)
+{
+    size_t length = strlen(payload);
+    if (length >= CLOUD_MAX_PAYLOAD)
+    {
+        return false;
+    }
+    boolean queued = false;
+    portENTER_CRITICAL(&this->_mux);
+    uint8_t next = (this->_head + 1) % LOOPBACK_DEPTH;
+    if (next != this->_tail)
+    {
+        InboundMessage *msg = &this->_pending[this->_head];
+        msg->type = type;
+        strncpy(msg->name, name, sizeof(msg->name) - 1);
+        msg->name[sizeof(msg->name) - 1] = '\0';
+        msg->length = length;
+        memcpy(msg->payload, payload, length + 1);
+        this->_head = next;
+        queued = true;
+    }
+    portEXIT_CRITICAL(&this->_mux);
+    return queued;
+}
+
+// Set the function to be called for every published message
+void LoopbackTransportClass::setPublishHook(PUBLISHHOOK hook)
+{
+    this->_hook = hook;
+}
+
+// How many messages have been published to the topic
+uint32_t LoopbackTransportClass::getPublished(TopicType topic)
+{
+    return topic == SHADOW_TOPIC ? this->_shadow_count : this->_telemetry_count;
+}
+
+// How many payload bytes have been published
+uint32_t LoopbackTransportClass::getPublishedBytes()
+{
+    return this->_bytes;
+}
+
+// Same layout as the AWS shadow
+JsonObject LoopbackTransportClass::stateSection(JsonDocument &doc, const char *section)
+{
+    JsonObject state = doc["state"].as<JsonObject>();
+    if (state.isNull())
+    {
+        state = doc.createNestedObject("state");
+    }
+    return state.createNestedObject(section);
+}
+
+JsonObject LoopbackTransportClass::stateReported(JsonDocument &doc)
+{
+    return this->stateSection(doc, "reported");
+}
+
+JsonObject LoopbackTransportClass::stateDesired(JsonDocument &doc)
+{
+    return this->stateSection(doc, "desired");
+}
+
+JsonObject LoopbackTransportClass::deltaProperties(JsonDocument &doc)
+{
+    return doc["state"].as<JsonObject>();
+}
+
+// Same as AWS so the ack is traced
+boolean LoopbackTransportClass::setClientToken(JsonDocument &doc, uint32_t token)
+{
+    char text[11];
+    snprintf(text, sizeof(text), "%u", token);
+    doc["clientToken"] = text;
+    return true;
+}
+
+LoopbackTransportClass LoopbackTransport;
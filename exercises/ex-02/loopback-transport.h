@@ -0,0 +1,51 @@
+#ifndef LOOPBACK_TRANSPORT_H
+#define LOOPBACK_TRANSPORT_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "cloud-transport.h"
+#include "network-task.h"
+
+const uint8_t LOOPBACK_DEPTH = 4;   // How many injected deltas/methods can be waiting
+
+typedef void (*PUBLISHHOOK)(TopicType topic, const char *payload);
+
+// In-process transport that never leaves the device.  Published messages are counted
+// and handed to an optional hook, deltas and methods can be injected to exercise the
+// application without a cloud endpoint.  Uses the AWS shadow document layout.
+class LoopbackTransportClass : public CloudTransport
+{
+    public:
+        LoopbackTransportClass();
+        const char *getName();
+        void begin();
+        boolean connect();
+        boolean isConnected();
+        boolean publishNow(TopicType topic, const char *payload);
+        void poll();
+        JsonObject stateReported(JsonDocument &doc);
+        JsonObject stateDesired(JsonDocument &doc);
+        JsonObject deltaProperties(JsonDocument &doc);
+        boolean setClientToken(JsonDocument &doc, uint32_t token);
+        boolean injectDelta(const char *payload);
+        boolean injectMethod(const char *method, const char *payload);
+        void setPublishHook(PUBLISHHOOK hook);
+        uint32_t getPublished(TopicType topic);
+        uint32_t getPublishedBytes();
+    private:
+        boolean inject(InboundType type, const char *name, const char *payload);
+        JsonObject stateSection(JsonDocument &doc, const char *section);
+        boolean _connected;
+        PUBLISHHOOK _hook;
+        volatile uint32_t _telemetry_count;
+        volatile uint32_t _shadow_count;
+        volatile uint32_t _bytes;
+        InboundMessage _pending[LOOPBACK_DEPTH];
+        volatile uint8_t _head;
+        volatile uint8_t _tail;
+        portMUX_TYPE _mux;
+};
+
+extern LoopbackTransportClass LoopbackTransport;
+
+#endif
@@ -0,0 +1,123 @@
+#include "metrics.h"
+
+// Names in the published document, kept short as the whole document has to fit in one message
+static const char *const COUNTER_NAMES[METRIC_COUNTER_COUNT] = {
+    "built", "queued", "published", "pub_failed", "twin", "control", "triggers", "evt_dropped", "in_dropped", "heap_warn",
+    "drop_ctl", "drop_state", "drop_tel", "defer_ctl", "defer_state", "defer_tel", "coalesced", "jobs_lost"
+};
+static const char *const GAUGE_NAMES[METRIC_GAUGE_COUNT] = {
+    "heap", "heap_blk", "heap_min", "frag", "rssi", "waiting"
+};
+static const char *const HISTOGRAM_NAMES[METRIC_HISTOGRAM_COUNT] = {
+    "evt_us", "render_us", "age_ms", "ser_us", "write_ms", "ack_ms", "sent_ms", "e2e_ms"
+};
+
+// Constructor
+MetricsClass::MetricsClass()
+    : _reported_at(0)
+{
+    memset((void *)this->_counters, 0, sizeof(this->_counters));
+    memset((void *)this->_gauges, 0, sizeof(this->_gauges));
+    memset((void *)this->_buckets, 0, sizeof(this->_buckets));
+    memset((void *)this->_max, 0, sizeof(this->_max));
+    memset(&this->_reported, 0, sizeof(this->_reported));
+}
+
+// Add to a counter, returns the new value
+uint32_t IRAM_ATTR MetricsClass::increment(MetricCounter counter, uint32_t by)
+{
+    return __atomic_add_fetch(&this->_counters[counter], by, __ATOMIC_RELAXED);
+}
+
+// Counter since boot
+uint32_t MetricsClass::get(MetricCounter counter)
+{
+    return __atomic_load_n(&this->_counters[counter], __ATOMIC_RELAXED);
+}
+
+// Set a gauge to its current value
+void IRAM_ATTR MetricsClass::set(MetricGauge gauge, int32_t value)
+{
+    __atomic_store_n(&this->_gauges[gauge], value, __ATOMIC_RELAXED);
+}
+
+// Latest value of a gauge
+int32_t MetricsClass::get(MetricGauge gauge)
+{
+    return __atomic_load_n(&this->_gauges[gauge], __ATOMIC_RELAXED);
+}
+
+// Count a duration in a histogram, same log scale buckets as HistogramClass and in the unit its name says
+void IRAM_ATTR MetricsClass::observe(MetricHistogram histogram, uint32_t value)
+{
+    __atomic_add_fetch(&this->_buckets[histogram][HistogramClass::bucketOf(value)], 1, __ATOMIC_RELAXED);
+    uint32_t seen = __atomic_load_n(&this->_max[histogram], __ATOMIC_RELAXED);
+    while (value > seen && !__atomic_compare_exchange_n(&this->_max[histogram], &seen, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+// Copy every metric as it is now
+void MetricsClass::snapshot(MetricsSnapshot *snapshot)
+{
+    for (uint8_t i = 0; i < METRIC_COUNTER_COUNT; i++)
+    {
+        snapshot->counters[i] = __atomic_load_n(&this->_counters[i], __ATOMIC_RELAXED);
+    }
+    for (uint8_t i = 0; i < METRIC_GAUGE_COUNT; i++)
+    {
+        snapshot->gauges[i] = __atomic_load_n(&this->_gauges[i], __ATOMIC_RELAXED);
+    }
+    for (uint8_t i = 0; i < METRIC_HISTOGRAM_COUNT; i++)
+    {
+        for (uint8_t j = 0; j < HISTOGRAM_BUCKETS; j++)
+        {
+            snapshot->buckets[i][j] = __atomic_load_n(&this->_buckets[i][j], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// The change in each counter, the gauges as they are and [count, p50, p99, max] of what each
+// histogram saw since the last report.  Counters that did not change and histograms that saw
+// nothing are left out to keep it to one message.  Call from one task only, it moves the baseline on.
+void MetricsClass::report(JsonObject json)
+{
+    MetricsSnapshot now;
+    this->snapshot(&now);
+    json["period_ms"] = millis() - this->_reported_at;
+
+    JsonObject counters = json.createNestedObject("c");
+    for (uint8_t i = 0; i < METRIC_COUNTER_COUNT; i++)
+    {
+        uint32_t delta = now.counters[i] - this->_reported.counters[i];
+        if (delta > 0)
+        {
+            counters[COUNTER_NAMES[i]] = delta;
+        }
+    }
+    JsonObject gauges = json.createNestedObject("g");
+    for (uint8_t i = 0; i < METRIC_GAUGE_COUNT; i++)
+    {
+        gauges[GAUGE_NAMES[i]] = now.gauges[i];
+    }
+    JsonObject histograms = json.createNestedObject("h");
+    HistogramClass delta;
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+    for (uint8_t i = 0; i < METRIC_HISTOGRAM_COUNT; i++)
+    {
+        for (uint8_t j = 0; j < HISTOGRAM_BUCKETS; j++)
+        {
+            buckets[j] = now.buckets[i][j] - this->_reported.buckets[i][j];
+        }
+        delta.load(buckets, __atomic_exchange_n(&this->_max[i], 0, __ATOMIC_RELAXED));
+        if (delta.getCount() > 0)
+        {
+            delta.summary(histograms.createNestedArray(HISTOGRAM_NAMES[i]));
+        }
+    }
+
+    this->_reported = now;
+    this->_reported_at = millis();
+}
+
+MetricsClass Metrics;
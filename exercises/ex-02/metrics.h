@@ -0,0 +1,93 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "histogram.h"
+
+const uint32_t METRICS_INTERVAL_MS = 60000;     // How often the metrics document is published
+
+// Every metric is declared here so its handle is a constant and its slot is fixed at compile time
+typedef enum {
+    METRIC_MSG_BUILT,           // Messages numbered by sendMessage
+    METRIC_MSG_QUEUED,          // Messages handed to the publish lanes
+    METRIC_PUBLISHED,           // Messages the transport took
+    METRIC_PUBLISH_FAILED,      // Messages the transport refused
+    METRIC_TWIN_UPDATES,        // Deltas received
+    METRIC_CONTROL_UPDATES,     // Methods and desired state changes handled
+    METRIC_TRIGGERS,            // Manual sensor reads
+    METRIC_EVENTS_DROPPED,      // ISR events lost to a full queue
+    METRIC_INBOUND_DROPPED,     // Deltas/methods lost to a full queue
+    METRIC_HEAP_WARNINGS,       // Times the largest free block got too small for TLS
+    METRIC_CONTROL_DROPPED,     // Messages a publish lane threw away, one per lane in PublishLane order
+    METRIC_STATE_DROPPED,
+    METRIC_TELEMETRY_DROPPED,
+    METRIC_CONTROL_DEFERRED,    // Messages a lane held back for its rate limit, one per lane
+    METRIC_STATE_DEFERRED,
+    METRIC_TELEMETRY_DEFERRED,
+    METRIC_COALESCED,           // Waiting messages replaced by a newer one with the same key
+    METRIC_JOBS_REJECTED,       // Jobs the scheduler had no room for, they never run
+    METRIC_COUNTER_COUNT
+} MetricCounter;
+
+typedef enum {
+    METRIC_HEAP_FREE,
+    METRIC_HEAP_LARGEST,        // Largest free block
+    METRIC_HEAP_MINIMUM,        // Lowest free heap since boot
+    METRIC_HEAP_FRAGMENTATION,  // % of the free heap not in the largest block
+    METRIC_RSSI,
+    METRIC_PUBLISH_WAITING,     // Messages waiting in the lanes
+    METRIC_GAUGE_COUNT
+} MetricGauge;
+
+typedef enum {
+    METRIC_EVENT_LATENCY,       // ISR to handler, us
+    METRIC_RENDER_TIME,         // Display frame, us
+    METRIC_TRACE_AGE,           // Sensor read to document built, ms
+    METRIC_TRACE_SERIALIZE,     // Document built to queued, us
+    METRIC_TRACE_WRITE,         // Queued to the socket, ms
+    METRIC_TRACE_ACK,           // Socket to the shadow accepting it, ms
+    METRIC_TRACE_SENT,          // Sensor read to the socket, ms
+    METRIC_TRACE_TOTAL,         // Sensor read to the shadow accepting it, ms, only messages that are acked
+    METRIC_HISTOGRAM_COUNT
+} MetricHistogram;
+
+// JSON document for a report with every metric in it, the text still has to fit in CLOUD_MAX_PAYLOAD
+const uint16_t METRICS_DOC_SIZE = JSON_OBJECT_SIZE(5) + JSON_OBJECT_SIZE(METRIC_COUNTER_COUNT)
+    + JSON_OBJECT_SIZE(METRIC_GAUGE_COUNT) + JSON_OBJECT_SIZE(METRIC_HISTOGRAM_COUNT)
+    + METRIC_HISTOGRAM_COUNT * JSON_ARRAY_SIZE(4);
+
+// Everything at one moment, each value is read atomically but not all of them together
+typedef struct {
+    uint32_t counters[METRIC_COUNTER_COUNT];
+    int32_t gauges[METRIC_GAUGE_COUNT];
+    uint32_t buckets[METRIC_HISTOGRAM_COUNT][HISTOGRAM_BUCKETS];
+} MetricsSnapshot;
+
+// One registry for the counters, gauges and histograms that used to be members scattered
+// over the classes.  Updates are single atomic operations in IRAM so ISRs and tasks on
+// either core can update the same metric without a lock.  report() writes what changed since
+// the last report as a compact document for the metrics topic.
+class MetricsClass
+{
+    public:
+        MetricsClass();
+        uint32_t increment(MetricCounter counter, uint32_t by = 1);
+        uint32_t get(MetricCounter counter);
+        void set(MetricGauge gauge, int32_t value);
+        int32_t get(MetricGauge gauge);
+        void observe(MetricHistogram histogram, uint32_t value);
+        void snapshot(MetricsSnapshot *snapshot);
+        void report(JsonObject json);
+    private:
+        volatile uint32_t _counters[METRIC_COUNTER_COUNT];
+        volatile int32_t _gauges[METRIC_GAUGE_COUNT];
+        volatile uint32_t _buckets[METRIC_HISTOGRAM_COUNT][HISTOGRAM_BUCKETS];
+        volatile uint32_t _max[METRIC_HISTOGRAM_COUNT];     // Since the last report
+        MetricsSnapshot _reported;      // What the last report was worked out from
+        uint32_t _reported_at;
+};
+
+extern MetricsClass Metrics;
+
+#endif
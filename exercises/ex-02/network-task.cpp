@@ -0,0 +1,108 @@
+#include "network-task.h"
+
+// Constructor
+NetworkTaskClass::NetworkTaskClass()
+    : _transport(NULL), _inbound(NULL), _task(NULL)
+{
+}
+
+// Create the delta queue and start the worker pinned to the requested core.
+// Must be called after the transport has connected as the worker then owns it.
+boolean NetworkTaskClass::begin(CloudTransport *transport, uint8_t core)
+{
+    this->_transport = transport;
+    this->_inbound = xQueueCreate(NETWORK_QUEUE_DEPTH, sizeof(InboundMessage));
+    if (this->_inbound == NULL)
+    {
+        Serial.println(F("Failed to create the network queue"));
+        return false;
+    }
+
+    if (xTaskCreatePinnedToCore(NetworkTaskClass::taskLoop, "network", NETWORK_TASK_STACK,
+                                this, NETWORK_TASK_PRIORITY, &this->_task, core) != pdPASS)
+    {
+        Serial.println(F("Failed to start the network task"));
+        this->_task = NULL;
+        return false;
+    }
+    Serial.printf("Network task running on core %u\r\n", core);
+    return true;
+}
+
+// Is the worker running, if not the caller must talk to the transport directly
+boolean NetworkTaskClass::isRunning()
+{
+    return this->_task != NULL;
+}
+
+// Tell the worker there are messages waiting in the publish scheduler
+void NetworkTaskClass::wake()
+{
+    if (this->_task != NULL)
+    {
+        xTaskNotifyGive(this->_task);
+    }
+}
+
+// Called from the transport callbacks on the worker so the delta/method is processed on the loop task
+boolean NetworkTaskClass::queueInbound(InboundType type, const char *name, const byte *payload, unsigned int length)
+{
+    InboundMessage msg;
+    if (length >= sizeof(msg.payload))
+    {
+        Metrics.increment(METRIC_INBOUND_DROPPED);
+        return false;
+    }
+    msg.type = type;
+    strncpy(msg.name, name != NULL ? name : "", sizeof(msg.name) - 1);
+    msg.name[sizeof(msg.name) - 1] = '\0';
+    msg.length = length;
+    memcpy(msg.payload, payload, length);
+    msg.payload[length] = '\0';
+    if (xQueueSend(this->_inbound, &msg, 0) != pdTRUE)
+    {
+        Metrics.increment(METRIC_INBOUND_DROPPED);
+        return false;
+    }
+    WakeScheduler.wake();
+    return true;
+}
+
+// Get the next delta/method if there is one waiting
+boolean NetworkTaskClass::nextInbound(InboundMessage *msg)
+{
+    return xQueueReceive(this->_inbound, msg, 0) == pdTRUE;
+}
+
+// How many deltas/methods have been thrown away
+uint32_t NetworkTaskClass::getInboundDropped()
+{
+    return Metrics.get(METRIC_INBOUND_DROPPED);
+}
+
+// Worker loop.  Publishes whatever the scheduler allows and keeps the transport connection serviced,
+// TLS stalls now only hold up this task and not the sampling/display on the loop task.
+void NetworkTaskClass::taskLoop(void *param)
+{
+    NetworkTaskClass *self = (NetworkTaskClass *)param;
+    OutboundMessage msg;
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(NETWORK_POLL_MS));
+        while (PublishScheduler.next(&msg))
+        {
+            if (self->_transport->publishNow(msg.topic, msg.payload))
+            {
+                Metrics.increment(METRIC_PUBLISHED);
+                Trace.mark(msg.trace, TRACE_WRITE);
+            }
+            else
+            {
+                Metrics.increment(METRIC_PUBLISH_FAILED);
+            }
+        }
+        self->_transport->poll();
+    }
+}
+
+NetworkTaskClass NetworkTask;
@@ -0,0 +1,46 @@
+#ifndef NETWORK_TASK_H
+#define NETWORK_TASK_H
+
+#include <Arduino.h>
+#include "cloud-transport.h"
+#include "publish-scheduler.h"
+#include "wake-scheduler.h"
+#include "metrics.h"
+#include "trace.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+const uint8_t NETWORK_QUEUE_DEPTH = 8;        // How many deltas/methods can wait for the loop task
+const uint8_t NETWORK_TASK_CORE = 0;          // Arduino loop() runs on core 1, so use the other one
+const uint32_t NETWORK_TASK_STACK = 8192;     // TLS needs a reasonable stack
+const uint8_t NETWORK_TASK_PRIORITY = 2;
+const uint16_t NETWORK_POLL_MS = 10;          // How long to sleep before servicing the transport and rate limited lanes
+
+typedef struct {
+    InboundType type;
+    char name[CLOUD_MAX_METHOD_NAME];
+    uint16_t length;
+    char payload[CLOUD_MAX_PAYLOAD];
+} InboundMessage;
+
+class NetworkTaskClass
+{
+    public:
+        NetworkTaskClass();
+        boolean begin(CloudTransport *transport, uint8_t core = NETWORK_TASK_CORE);
+        boolean isRunning();
+        void wake();
+        boolean queueInbound(InboundType type, const char *name, const byte *payload, unsigned int length);
+        boolean nextInbound(InboundMessage *msg);
+        uint32_t getInboundDropped();
+    private:
+        static void taskLoop(void *param);
+        CloudTransport *_transport;
+        QueueHandle_t _inbound;
+        TaskHandle_t _task;
+};
+
+extern NetworkTaskClass NetworkTask;
+
+#endif
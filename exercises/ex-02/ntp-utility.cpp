@@ -1,64 +1,488 @@
 #include "ntp-utility.h"
+#include "profile.h"
+#include "lwip/dns.h"
 
 WiFiUDP ntpUDP;
 
+// Convert days since 1970-01-01 to the civil date in constant time.
+// Based on http://howardhinnant.github.io/date_algorithms.html#civil_from_days
+static void civilFromDays(uint32_t days, uint16_t *year, uint8_t *month, uint8_t *day)
+{
+    uint32_t z = days + 719468;                 // Shift the epoch to 0000-03-01
+    uint32_t era = z / 146097;                  // 400 year eras
+    uint32_t doe = z - era * 146097;            // Day of era [0, 146096]
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;          // March is month 0
+    *day = doy - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 3 : mp - 9;
+    *year = yoe + era * 400 + (*month <= 2 ? 1 : 0);
+}
+
+// NTP timestamps are seconds since 1900 and a 32 bit binary fraction
+static uint64_t ntpToEpochMs(const byte *data)
+{
+    uint32_t secs = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+    uint32_t frac = ((uint32_t)data[4] << 24) | ((uint32_t)data[5] << 16) | ((uint32_t)data[6] << 8) | data[7];
+    return (uint64_t)(secs - 2208988800UL) * 1000 + (((uint64_t)frac * 1000) >> 32);
+}
+
+// Write a zero padded number without going through printf
+static char *writeDigits(char *out, uint32_t value, uint8_t width)
+{
+    for (int8_t i = width - 1; i >= 0; i--)
+    {
+        out[i] = '0' + (value % 10);
+        value /= 10;
+    }
+    return out + width;
+}
+
+// Async DNS answer for one of the servers, runs on the lwIP task
+static void dnsFound(const char *name, const ip_addr_t *ipaddr, void *arg)
+{
+    NtpServer *server = (NtpServer *)arg;
+    if (ipaddr != NULL)
+    {
+        server->address = IPAddress(ip4_addr_get_u32(ip_2_ip4(ipaddr)));
+        server->resolved = true;
+    }
+    server->resolving = false;
+}
+
+// Write a 64 bit value big endian
+static void writeToken(byte *data, uint64_t token)
+{
+    for (int8_t i = 7; i >= 0; i--)
+    {
+        data[i] = token & 0xFF;
+        token >>= 8;
+    }
+}
+
+// Read a 64 bit big endian value
+static uint64_t readToken(const byte *data)
+{
+    uint64_t token = 0;
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        token = (token << 8) | data[i];
+    }
+    return token;
+}
+
 NTPUtilityClass::NTPUtilityClass()
-    :_ntp(ntpUDP, "pool.ntp.org") // Default NTP site
-    {}
+    :_server_count(0), _round_active(false), _round_started(0),
+     _base_ms(0), _base_us(0), _drift_ppb(0), _interval_ms(NTP_MIN_INTERVAL_MS), _last_attempt(0), _last_sync(0), _job(NO_JOB),
+     _date_day(0xFFFFFFFF)
+    {
+        this->_date[0] = '\0';
+        this->_mux = portMUX_INITIALIZER_UNLOCKED;
+        memset(&this->_quality, 0, sizeof(this->_quality));
+    }
 
+// Add a server to query, call before begin.  With none the pool servers are used.
+boolean NTPUtilityClass::addServer(const char *name)
+{
+    if (this->_server_count >= NTP_MAX_SERVERS)
+    {
+        return false;
+    }
+    NtpServer *server = &this->_servers[this->_server_count++];
+    memset(server, 0, sizeof(NtpServer));
+    server->name = name;
+    return true;
+}
+
+// Start the first round of queries and give it a short time to get a fix
 void NTPUtilityClass::begin()
 {
-    this->_ntp.begin();
-    this->_ntp.update();
-}
-
-String NTPUtilityClass::getFormattedDate()  // Convert epoch time to date - Surprising not part of NTPClient Package!
-{
-    unsigned long rawTime = this->_ntp.getEpochTime() / 86400L;  // in days
-    unsigned long days = 0, year = 1970;
-    uint8_t month;
-    static const uint8_t monthDays[]={31,28,31,30,31,30,31,31,30,31,30,31};
-
-    while((days += (LEAP_YEAR(year) ? 366 : 365)) <= rawTime)
-        year++;
-      
-    rawTime -= days - (LEAP_YEAR(year) ? 366 : 365); // now it is days in this year, starting at 0
-    days=0;
-    for (month=0; month<12; month++) {
-        uint8_t monthLength;
-        if (month==1) 
-        { // february
-            monthLength = LEAP_YEAR(year) ? 29 : 28;
-        } else {
-            monthLength = monthDays[month];
+    if (this->_server_count == 0)
+    {
+        for (uint8_t i = 0; i < NTP_MAX_SERVERS; i++)
+        {
+            this->addServer(NTP_DEFAULT_SERVERS[i]);
         }
-        if (rawTime < monthLength) break;
-        rawTime -= monthLength;
     }
-    String monthStr = ++month < 10 ? "0" + String(month) : String(month); // jan is month 1  
-    String dayStr = ++rawTime < 10 ? "0" + String(rawTime) : String(rawTime); // day of month  
-    return String(year) + "-" + monthStr + "-" + dayStr;    
+    ntpUDP.begin(NTP_LOCAL_PORT);
+    if (this->_job == NO_JOB)
+    {
+        this->_job = Scheduler.add("ntp", syncJob);
+    }
+
+    // Due straight away rather than one interval after boot
+    this->_last_attempt = millis() - this->_interval_ms;
+    uint32_t start = millis();
+    while (!this->isSynced() && (millis() - start) < NTP_BEGIN_WAIT_MS)
+    {
+        this->tick();
+        delay(10);
+    }
 }
 
-String NTPUtilityClass::getISO8601Formatted()   // Convert epoch time to ISO8601 formatted date/time
+// Look the server up without waiting, the answer arrives in dnsFound
+void NTPUtilityClass::resolve(NtpServer *server)
 {
-    String date = this->getFormattedDate();
-    return date + String("T") + this->_ntp.getFormattedTime() + "Z";
+    ip_addr_t addr;
+    server->resolving = true;
+    err_t err = dns_gethostbyname(server->name, &addr, dnsFound, server);
+    if (err == ERR_OK)
+    {
+        server->address = IPAddress(ip4_addr_get_u32(ip_2_ip4(&addr)));
+        server->resolved = true;
+        server->resolving = false;
+    }
+    else if (err != ERR_INPROGRESS)
+    {
+        server->resolving = false;
+    }
 }
 
-String NTPUtilityClass::getFormattedTime()      // Get the formatted time from the generic NTP Client
+// Send a request to every server that has an address.  Our send time and the server
+// index go in the transmit timestamp, the server hands it back as the originate timestamp.
+void NTPUtilityClass::startRound()
 {
-    return this->_ntp.getFormattedTime();
+    byte packet[NTP_PACKET_SIZE];
+    uint8_t sent = 0;
+    boolean waiting = false;
+
+    while (ntpUDP.parsePacket() > 0)    // Throw away any late replies
+    {
+        ntpUDP.flush();
+    }
+    for (uint8_t i = 0; i < this->_server_count; i++)
+    {
+        NtpServer *server = &this->_servers[i];
+        server->answered = false;
+        if (!server->resolved)
+        {
+            if (!server->resolving)
+            {
+                this->resolve(server);
+            }
+            waiting = waiting || server->resolving;
+            continue;
+        }
+        memset(packet, 0, sizeof(packet));
+        packet[0] = 0x1B;                   // LI 0, Version 3, Mode 3 (client)
+        server->token = ((uint64_t)esp_timer_get_time() << 3) | i;
+        writeToken(packet + 40, server->token);
+        ntpUDP.beginPacket(server->address, NTP_PORT);
+        ntpUDP.write(packet, sizeof(packet));
+        ntpUDP.endPacket();
+        server->requests++;
+        sent++;
+    }
+
+    if (sent > 0)
+    {
+        this->_round_active = true;
+        this->_round_started = millis();
+        this->_replies = 0;
+    }
+    else if (!waiting)
+    {
+        // Nothing to ask and no lookups running, try again later
+        this->_last_attempt = millis();
+        this->_quality.failures++;
+        this->_interval_ms = NTP_RETRY_MS;
+    }
+}
+
+// Read any replies that have arrived, never waits
+void NTPUtilityClass::receiveReplies()
+{
+    byte packet[NTP_PACKET_SIZE];
+    while (ntpUDP.parsePacket() > 0)
+    {
+        int64_t received = esp_timer_get_time();
+        if (ntpUDP.read(packet, sizeof(packet)) < NTP_PACKET_SIZE)
+        {
+            continue;
+        }
+        uint64_t token = readToken(packet + 24);
+        uint8_t index = token & 0x07;
+        uint8_t mode = packet[0] & 0x07;
+        uint8_t leap = packet[0] >> 6;
+        if (index >= this->_server_count || this->_servers[index].token != token || this->_servers[index].answered
+            || mode != 4 || leap == 3 || packet[1] == 0)  // Not ours, a duplicate, not a server, unsynchronised or kiss of death
+        {
+            continue;
+        }
+
+        NtpServer *server = &this->_servers[index];
+        int64_t sent = token >> 3;
+        uint64_t serverReceive = ntpToEpochMs(packet + 32);
+        uint64_t serverTransmit = ntpToEpochMs(packet + 40);
+        int64_t rtt = (received - sent) / 1000 - (int64_t)(serverTransmit - serverReceive);
+        if (rtt < 0)
+        {
+            rtt = 0;
+        }
+        // The server transmit time plus half the round trip is the epoch when the reply arrived
+        server->sample_ms = serverTransmit + rtt / 2;
+        server->sample_us = received;
+        server->rtt_ms = rtt;
+        server->rtt_avg_ms = server->replies == 0 ? rtt : server->rtt_avg_ms + ((int32_t)rtt - (int32_t)server->rtt_avg_ms) / 4;
+        server->offset_ms = this->isSynced() ? (int64_t)server->sample_ms - (int64_t)this->toEpochMs(received) : 0;
+        server->replies++;
+        server->missed = 0;
+        server->answered = true;
+        this->_replies++;
+    }
 }
 
-void NTPUtilityClass::tick()                  // Call the NTP update function to pool the site
+// Everyone has answered or the time is up.  The reply with the shortest round trip has the
+// smallest error so that is the one the clock is set from.
+void NTPUtilityClass::finishRound()
 {
-    this->_ntp.update();
+    int8_t best = -1;
+    this->_round_active = false;
+    this->_last_attempt = millis();
+    for (uint8_t i = 0; i < this->_server_count; i++)
+    {
+        NtpServer *server = &this->_servers[i];
+        if (!server->resolved)
+        {
+            continue;
+        }
+        if (!server->answered)
+        {
+            server->timeouts++;
+            // Keep missing then the address may have changed (pool servers do)
+            if (++server->missed >= NTP_RESOLVE_AFTER)
+            {
+                server->resolved = false;
+                server->missed = 0;
+            }
+            continue;
+        }
+        if (best < 0 || server->rtt_ms < this->_servers[best].rtt_ms)
+        {
+            best = i;
+        }
+    }
+
+    if (best < 0)
+    {
+        this->_quality.failures++;
+        this->_interval_ms = NTP_RETRY_MS;
+        return;
+    }
+    NtpServer *server = &this->_servers[best];
+    this->_quality.server = best;
+    this->applySample(server->sample_ms, server->sample_us, server->rtt_ms);
+}
+
+// Update the drift estimate and rebase the local clock on the chosen sample
+void NTPUtilityClass::applySample(uint64_t measured, int64_t local, uint32_t rtt)
+{
+    portENTER_CRITICAL(&this->_mux);
+    if (this->_quality.syncs > 0)
+    {
+        // Whatever is left over after the current correction is extra drift over the interval
+        int64_t elapsed = local - this->_base_us;
+        int64_t offset = (int64_t)measured - (int64_t)this->epochAt(local);
+        // A big offset is a step (server change or first proper fix) and says nothing about drift
+        if (elapsed > 0 && offset > -NTP_STEP_MS && offset < NTP_STEP_MS)
+        {
+            int64_t residual = offset * 1000000000000LL / elapsed;      // ms over us, scaled to ppb
+            int64_t drift = this->_drift_ppb + residual / 2;            // Only take half to smooth out the jitter
+            this->_drift_ppb = constrain(drift, -NTP_MAX_DRIFT_PPB, NTP_MAX_DRIFT_PPB);
+        }
+        this->_quality.last_offset_ms = offset;
+    }
+    this->_base_ms = measured;
+    this->_base_us = local;
+    this->_last_sync = millis();
+    this->_quality.syncs++;
+    this->_quality.last_rtt_ms = rtt;
+    this->_quality.drift_ppb = this->_drift_ppb;
+    portEXIT_CRITICAL(&this->_mux);
+
+    // Back off once the clock is holding its time
+    if (abs(this->_quality.last_offset_ms) < NTP_GOOD_OFFSET_MS)
+    {
+        this->_interval_ms = constrain(this->_interval_ms * 2, NTP_MIN_INTERVAL_MS, NTP_MAX_INTERVAL_MS);
+    }
+    else
+    {
+        this->_interval_ms = NTP_MIN_INTERVAL_MS;
+    }
+}
+
+// Epoch in ms for a local esp_timer reading, corrected for the drift
+uint64_t NTPUtilityClass::epochAt(int64_t localUs)
+{
+    int64_t elapsed = localUs - this->_base_us;
+    elapsed += elapsed * this->_drift_ppb / 1000000000LL;
+    return this->_base_ms + elapsed / 1000;
+}
+
+void NTPUtilityClass::updateDate(unsigned long epoch)   // Only work out the date when the day changes
+{
+    uint32_t days = epoch / 86400L;
+    if (days == this->_date_day)
+    {
+        return;
+    }
+    uint16_t year;
+    uint8_t month, day;
+    civilFromDays(days, &year, &month, &day);
+    char *out = writeDigits(this->_date, year, 4);
+    *out++ = '-';
+    out = writeDigits(out, month, 2);
+    *out++ = '-';
+    out = writeDigits(out, day, 2);
+    *out = '\0';
+    this->_date_day = days;
+}
+
+size_t NTPUtilityClass::getFormattedDate(char *buffer, size_t size)   // Convert epoch time to date - Surprising not part of NTPClient Package!
+{
+    if (size < NTP_DATE_SIZE)
+    {
+        return 0;
+    }
+    this->updateDate(this->getEpoch());
+    memcpy(buffer, this->_date, NTP_DATE_SIZE);
+    return NTP_DATE_SIZE - 1;
+}
+
+size_t NTPUtilityClass::getFormattedTime(char *buffer, size_t size)   // Convert epoch time to HH:MM:SS
+{
+    if (size < NTP_TIME_SIZE)
+    {
+        return 0;
+    }
+    unsigned long secs = this->getEpoch() % 86400L;
+    char *out = writeDigits(buffer, secs / 3600, 2);
+    *out++ = ':';
+    out = writeDigits(out, (secs / 60) % 60, 2);
+    *out++ = ':';
+    out = writeDigits(out, secs % 60, 2);
+    *out = '\0';
+    return NTP_TIME_SIZE - 1;
+}
+
+size_t NTPUtilityClass::getISO8601Formatted(char *buffer, size_t size)   // Convert epoch time to ISO8601 formatted date/time
+{
+    PROFILE_SCOPE(PROBE_ISO8601);
+    if (size < NTP_ISO8601_SIZE)
+    {
+        return 0;
+    }
+    // Read the epoch once so the date and time always agree at midnight
+    unsigned long epoch = this->getEpoch();
+    unsigned long secs = epoch % 86400L;
+    this->updateDate(epoch);
+    memcpy(buffer, this->_date, NTP_DATE_SIZE - 1);
+    char *out = buffer + NTP_DATE_SIZE - 1;
+    *out++ = 'T';
+    out = writeDigits(out, secs / 3600, 2);
+    *out++ = ':';
+    out = writeDigits(out, (secs / 60) % 60, 2);
+    *out++ = ':';
+    out = writeDigits(out, secs % 60, 2);
+    *out++ = 'Z';
+    *out = '\0';
+    return NTP_ISO8601_SIZE - 1;
+}
+
+String NTPUtilityClass::getFormattedDate()
+{
+    char buffer[NTP_DATE_SIZE];
+    this->getFormattedDate(buffer, sizeof(buffer));
+    return String(buffer);
+}
+
+String NTPUtilityClass::getISO8601Formatted()
+{
+    char buffer[NTP_ISO8601_SIZE];
+    this->getISO8601Formatted(buffer, sizeof(buffer));
+    return String(buffer);
+}
+
+String NTPUtilityClass::getFormattedTime()
+{
+    char buffer[NTP_TIME_SIZE];
+    this->getFormattedTime(buffer, sizeof(buffer));
+    return String(buffer);
+}
+
+void NTPUtilityClass::tick()                  // Never blocks, picks up replies or starts a round then arms the job for what is next
+{
+    if (this->_round_active)
+    {
+        this->receiveReplies();
+        if (this->_replies >= this->_server_count || (millis() - this->_round_started) >= NTP_TIMEOUT_MS)
+        {
+            this->finishRound();
+        }
+    }
+    else if ((millis() - this->_last_attempt) >= this->_interval_ms)
+    {
+        this->startRound();
+    }
+
+    uint32_t waited = millis() - this->_last_attempt;
+    if (this->_round_active || waited >= this->_interval_ms)
+    {
+        Scheduler.schedule(this->_job, NTP_POLL_MS);    // Replies and lookups are not signalled so keep looking for them
+    }
+    else
+    {
+        Scheduler.schedule(this->_job, this->_interval_ms - waited);
+    }
+}
+
+void NTPUtilityClass::syncJob()               // The scheduler's way in to tick()
+{
+    NTPUtility.tick();
 }
 
 long NTPUtilityClass::getEpoch()                // Get the current epoch time
 {
-    return this->_ntp.getEpochTime();
+    return this->getEpochMs() / 1000;
+}
+
+uint64_t NTPUtilityClass::getEpochMs()          // Get the current epoch time in ms, no network involved
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&this->_mux);
+    uint64_t epoch = this->epochAt(now);
+    portEXIT_CRITICAL(&this->_mux);
+    return epoch;
+}
+
+uint64_t NTPUtilityClass::toEpochMs(int64_t localUs)    // Convert an esp_timer reading i.e. from an ISR to the epoch in ms
+{
+    portENTER_CRITICAL(&this->_mux);
+    uint64_t epoch = this->epochAt(localUs);
+    portEXIT_CRITICAL(&this->_mux);
+    return epoch;
+}
+
+uint8_t NTPUtilityClass::getServerCount()       // How many servers are being queried
+{
+    return this->_server_count;
+}
+
+const NtpServer *NTPUtilityClass::getServer(uint8_t index)  // Per server statistics
+{
+    return index < this->_server_count ? &this->_servers[index] : NULL;
+}
+
+boolean NTPUtilityClass::isSynced()             // Has there been at least one good sync
+{
+    return this->_quality.syncs > 0;
+}
+
+ClockQuality NTPUtilityClass::getQuality()      // How well the clock is being held
+{
+    ClockQuality quality = this->_quality;
+    quality.age_ms = millis() - this->_last_sync;
+    return quality;
 }
 
 NTPUtilityClass NTPUtility;                     // Single instance declaration
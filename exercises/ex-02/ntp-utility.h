@@ -4,24 +4,108 @@
 #include <M5Stack.h>
 #include <WiFi.h>
 #include <WiFiUdp.h>
-#include <NTPClient.h>
+#include "esp_timer.h"
+#include "job-scheduler.h"
 
-#ifndef LEAP_YEAR
-#define LEAP_YEAR(Y)     ( (Y>0) && !(Y%4) && ( (Y%100) || !(Y%400) ) )
-#endif
+const uint8_t NTP_DATE_SIZE = 11;       // YYYY-MM-DD plus terminator
+const uint8_t NTP_TIME_SIZE = 9;        // HH:MM:SS plus terminator
+const uint8_t NTP_ISO8601_SIZE = 21;    // YYYY-MM-DDTHH:MM:SSZ plus terminator
+
+const uint16_t NTP_PORT = 123;
+const uint16_t NTP_LOCAL_PORT = 1337;
+const uint8_t NTP_PACKET_SIZE = 48;
+const uint32_t NTP_TIMEOUT_MS = 1000;           // How long a round waits for the servers
+const uint32_t NTP_BEGIN_WAIT_MS = 2000;        // How long begin waits for the first fix
+const uint32_t NTP_POLL_MS = 20;               // How often to look for replies during a round
+const uint8_t NTP_MAX_SERVERS = 3;
+const uint8_t NTP_RESOLVE_AFTER = 3;            // Look the address up again after this many timeouts in a row
+const char *const NTP_DEFAULT_SERVERS[NTP_MAX_SERVERS] = {"0.pool.ntp.org", "1.pool.ntp.org", "2.pool.ntp.org"};
+const uint32_t NTP_MIN_INTERVAL_MS = 64000;     // Sync often at first to learn the drift
+const uint32_t NTP_MAX_INTERVAL_MS = 1024000;   // Then back off to this
+const uint32_t NTP_RETRY_MS = 16000;            // Retry after a failure
+const int32_t NTP_MAX_DRIFT_PPB = 500000;       // Anything more than 500ppm is not a crystal
+const int32_t NTP_GOOD_OFFSET_MS = 50;          // Offset small enough to back off the sync interval
+const int32_t NTP_STEP_MS = 1000;               // Offset too big to be drift
+
+typedef struct {
+    uint32_t syncs;             // Good syncs since boot
+    uint32_t failures;          // Queries that timed out
+    int32_t last_offset_ms;     // How far out the local clock was at the last sync
+    uint32_t last_rtt_ms;       // Round trip of the last sync
+    int32_t drift_ppb;          // Estimated oscillator drift, parts per billion
+    uint32_t age_ms;            // Time since the last good sync
+    uint8_t server;             // Which server the last sync came from
+} ClockQuality;
+
+typedef struct {
+    const char *name;
+    IPAddress address;
+    volatile boolean resolved;
+    volatile boolean resolving;
+    uint32_t requests;
+    uint32_t replies;
+    uint32_t timeouts;
+    uint8_t missed;             // Timeouts in a row
+    uint32_t rtt_ms;            // Last round trip
+    uint32_t rtt_avg_ms;        // Smoothed round trip
+    int32_t offset_ms;          // Last reply compared to the local clock
+    // Current round
+    uint64_t token;
+    boolean answered;
+    uint64_t sample_ms;
+    int64_t sample_us;
+} NtpServer;
 
+// Disciplined clock.  Syncs with SNTP on a schedule, learns how fast the local
+// oscillator runs compared to the server and works out the epoch in between
+// syncs from esp_timer without touching the network.  Each sync asks all the
+// servers at once, tick() collects the replies without waiting and the one
+// with the shortest round trip is used.
 class NTPUtilityClass 
 {
     public:
         NTPUtilityClass();
         void begin();
+        boolean addServer(const char *name);
         String getFormattedDate();
         String getISO8601Formatted();
         String getFormattedTime();
+        size_t getFormattedDate(char *buffer, size_t size);
+        size_t getISO8601Formatted(char *buffer, size_t size);
+        size_t getFormattedTime(char *buffer, size_t size);
         void tick();
         long getEpoch();
+        uint64_t getEpochMs();
+        uint64_t toEpochMs(int64_t localUs);
+        boolean isSynced();
+        ClockQuality getQuality();
+        uint8_t getServerCount();
+        const NtpServer *getServer(uint8_t index);
     private:
-        NTPClient _ntp;
+        void updateDate(unsigned long epoch);
+        void resolve(NtpServer *server);
+        void startRound();
+        static void syncJob();
+        void receiveReplies();
+        void finishRound();
+        void applySample(uint64_t measured, int64_t local, uint32_t rtt);
+        uint64_t epochAt(int64_t localUs);
+        NtpServer _servers[NTP_MAX_SERVERS];
+        uint8_t _server_count;
+        boolean _round_active;
+        uint32_t _round_started;
+        uint8_t _replies;
+        uint64_t _base_ms;              // Epoch at the last sync
+        int64_t _base_us;               // esp_timer at the last sync
+        int32_t _drift_ppb;
+        uint32_t _interval_ms;
+        uint32_t _last_attempt;
+        uint32_t _last_sync;
+        int8_t _job;                    // Scheduler job that runs tick(), re-armed for whatever is next
+        ClockQuality _quality;
+        portMUX_TYPE _mux;
+        uint32_t _date_day;             // Day the cached date is for
+        char _date[NTP_DATE_SIZE];      // Cached YYYY-MM-DD
 };
 
 extern NTPUtilityClass NTPUtility;
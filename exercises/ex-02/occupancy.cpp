@@ -0,0 +1,140 @@
+#include "occupancy.h"
+
+// Constructor
+OccupancyClass::OccupancyClass()
+    : _state(VACANT), _hold_ms(OCCUPANCY_HOLD_MS), _window_ms(OCCUPANCY_WINDOW_MS), _state_since(0), _counted_since(0),
+      _hold_job(NO_JOB), _window_job(NO_JOB), _window_start(0), _window_motion(0), _last_motion(0), _motion_count(0), _transitions(0), _changed(false), _window_due(false)
+{
+    memset(this->_time_in, 0, sizeof(this->_time_in));
+}
+
+// Start vacant with a fresh window
+void OccupancyClass::begin(uint32_t holdMs, uint32_t windowMs)
+{
+    uint32_t now = millis();
+    this->_hold_ms = holdMs;
+    this->_window_ms = windowMs;
+    this->_state = VACANT;
+    this->_state_since = now;
+    this->_counted_since = now;
+    this->_window_start = now;
+    if (this->_window_job == NO_JOB)
+    {
+        this->_hold_job = Scheduler.add("occupancy-hold", holdJob);
+        this->_window_job = Scheduler.every("occupancy-window", windowMs, windowJob, JOB_LOW);
+    }
+}
+
+// Motion from the PIR, called on the loop task with the time the ISR saw it.  The hold time
+// runs from then, not from when the event got here.
+void OccupancyClass::motion(int64_t timeUs)
+{
+    uint32_t at = timeUs / 1000;
+    uint32_t late = millis() - at;
+    this->_last_motion = at;
+    Scheduler.schedule(this->_hold_job, late < this->_hold_ms ? this->_hold_ms - late : 0);
+    this->_window_motion++;
+    this->_motion_count++;
+    if (this->_state == VACANT)
+    {
+        this->setState(OCCUPIED, at);
+    }
+}
+
+// Returns true when there is something to report
+boolean OccupancyClass::tick()
+{
+    return this->_changed || this->_window_due;
+}
+
+// No motion for the hold time
+void OccupancyClass::holdJob()
+{
+    if (Occupancy._state == OCCUPIED)
+    {
+        Occupancy.setState(VACANT, Occupancy._last_motion + Occupancy._hold_ms);
+    }
+}
+
+// End of a window, the next report carries its aggregates
+void OccupancyClass::windowJob()
+{
+    Occupancy._window_due = true;
+}
+
+// Fill in the occupancy and this window's aggregates.  A finished window starts a new one.
+void OccupancyClass::report(JsonObject json)
+{
+    uint32_t now = millis();
+    json["state"] = this->_state == OCCUPIED ? "occupied" : "vacant";
+    json["state_ms"] = now - this->_state_since;
+    json["reason"] = this->_changed ? "change" : "window";
+    json["window_ms"] = now - this->_window_start;
+    json["motion"] = this->_window_motion;
+    json["occupied_ms"] = this->timeIn(OCCUPIED, now);
+    json["vacant_ms"] = this->timeIn(VACANT, now);
+    json["transitions"] = this->_transitions;
+    this->_changed = false;
+
+    if (this->_window_due)
+    {
+        this->_window_due = false;
+        this->_window_start = now;
+        this->_window_motion = 0;
+        this->_counted_since = now;
+        memset(this->_time_in, 0, sizeof(this->_time_in));
+    }
+}
+
+// Occupied or vacant
+OccupancyState OccupancyClass::getState()
+{
+    return this->_state;
+}
+
+// Motion events since boot
+uint32_t OccupancyClass::getMotionCount()
+{
+    return this->_motion_count;
+}
+
+// Changes of state since boot
+uint32_t OccupancyClass::getTransitions()
+{
+    return this->_transitions;
+}
+
+// Move to a new state at millis() at, the time in the old one is added to the window
+void OccupancyClass::setState(OccupancyState state, uint32_t at)
+{
+    // An event from before the window started only counts from the start, and nothing is in the future
+    uint32_t now = millis();
+    if ((int32_t)(at - now) > 0)
+    {
+        at = now;
+    }
+    if ((int32_t)(at - this->_counted_since) < 0)
+    {
+        at = this->_counted_since;
+    }
+    this->_time_in[this->_state] += at - this->_counted_since;
+    this->_counted_since = at;
+    this->_state_since = at;
+    this->_state = state;
+    this->_transitions++;
+    this->_changed = true;
+    Serial.printf("Room is now %s\r\n", state == OCCUPIED ? "occupied" : "vacant");
+}
+
+// Time in a state this window including the current spell
+uint32_t OccupancyClass::timeIn(OccupancyState state, uint32_t now)
+{
+    uint32_t total = this->_time_in[state];
+    if (this->_state == state)
+    {
+        total += now - this->_counted_since;
+    }
+    return total;
+}
+
+OccupancyClass Occupancy;
@@ -0,0 +1,56 @@
+#ifndef OCCUPANCY_H
+#define OCCUPANCY_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "job-scheduler.h"
+
+const uint32_t OCCUPANCY_HOLD_MS = 300000;      // No motion for this long and the room is vacant
+const uint32_t OCCUPANCY_WINDOW_MS = 900000;    // How often the aggregates are reported
+
+typedef enum {
+    VACANT,
+    OCCUPIED,
+    OCCUPANCY_STATE_COUNT
+} OccupancyState;
+
+// Turns the PIR motion events into occupancy.  Motion makes the room occupied, no motion
+// for the hold time makes it vacant.  Only the changes of state and a summary per window
+// (motion count, time in each state) need sending, not every PIR pulse.  The hold time and
+// window are scheduler jobs so nothing is checked while the room is quiet.
+class OccupancyClass
+{
+    public:
+        OccupancyClass();
+        void begin(uint32_t holdMs = OCCUPANCY_HOLD_MS, uint32_t windowMs = OCCUPANCY_WINDOW_MS);
+        void motion(int64_t timeUs);
+        boolean tick();
+        void report(JsonObject json);
+        OccupancyState getState();
+        uint32_t getMotionCount();
+        uint32_t getTransitions();
+    private:
+        void setState(OccupancyState state, uint32_t at);
+        uint32_t timeIn(OccupancyState state, uint32_t now);
+        static void holdJob();
+        static void windowJob();
+        OccupancyState _state;
+        uint32_t _hold_ms;
+        uint32_t _window_ms;
+        uint32_t _state_since;          // millis() of the last change of state
+        uint32_t _counted_since;        // millis() the current state has been added to _time_in up to
+        int8_t _hold_job;               // One-shot pushed back by every motion, runs when the room goes quiet
+        int8_t _window_job;
+        uint32_t _window_start;
+        uint32_t _window_motion;        // Motion events this window
+        uint32_t _last_motion;          // millis() the last motion was seen by the ISR
+        uint32_t _time_in[OCCUPANCY_STATE_COUNT];   // ms in each state this window
+        uint32_t _motion_count;
+        uint32_t _transitions;
+        boolean _changed;               // State changed since the last report
+        boolean _window_due;            // Window finished since the last report
+};
+
+extern OccupancyClass Occupancy;
+
+#endif
@@ -0,0 +1,129 @@
+#include "profile.h"
+#if PROFILE_ENABLED
+
+#if defined(ESP32)
+#include <xtensa/hal.h>
+#else
+#include <time.h>
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+#endif
+
+static const char *const PROBE_NAMES[PROBE_COUNT] = {
+    "read", "delta", "send", "iso", "render", "field"
+};
+
+// Constructor
+ProfilerClass::ProfilerClass()
+{
+    this->clear();
+}
+
+// Current tick
+uint32_t IRAM_ATTR ProfilerClass::now()
+{
+#if defined(ESP32)
+    return xthal_get_ccount();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#endif
+}
+
+// Ticks in a microsecond
+uint32_t ProfilerClass::ticksPerMicro()
+{
+#if defined(ESP32)
+    return ESP.getCpuFreqMHz();
+#else
+    return 1000;
+#endif
+}
+
+// Add one call that took ticks
+void IRAM_ATTR ProfilerClass::record(ProbeId probe, uint32_t ticks)
+{
+    ProbeStats *stats = &this->_probes[probe];
+    __atomic_add_fetch(&stats->calls, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->total, (uint64_t)ticks, __ATOMIC_RELAXED);
+    uint32_t seen = __atomic_load_n(&stats->min, __ATOMIC_RELAXED);
+    while (ticks < seen && !__atomic_compare_exchange_n(&stats->min, &seen, ticks, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+    seen = __atomic_load_n(&stats->max, __ATOMIC_RELAXED);
+    while (ticks > seen && !__atomic_compare_exchange_n(&stats->max, &seen, ticks, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+// Copy out one probe
+void ProfilerClass::get(ProbeId probe, ProbeStats *stats)
+{
+    ProbeStats *from = &this->_probes[probe];
+    stats->calls = __atomic_load_n(&from->calls, __ATOMIC_RELAXED);
+    stats->total = __atomic_load_n(&from->total, __ATOMIC_RELAXED);
+    stats->min = __atomic_load_n(&from->min, __ATOMIC_RELAXED);
+    stats->max = __atomic_load_n(&from->max, __ATOMIC_RELAXED);
+}
+
+// Start every probe again
+void ProfilerClass::clear()
+{
+    for (uint8_t i = 0; i < PROBE_COUNT; i++)
+    {
+        ProbeStats *stats = &this->_probes[i];
+        __atomic_store_n(&stats->calls, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->total, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->min, UINT32_MAX, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->max, 0, __ATOMIC_RELAXED);
+    }
+}
+
+// Dump every probe that has been hit to the serial port, in microseconds
+void ProfilerClass::print()
+{
+    float perMicro = ticksPerMicro();
+    ProbeStats stats;
+    Serial.printf("Probe   calls      avg us    min us    max us\r\n");
+    for (uint8_t i = 0; i < PROBE_COUNT; i++)
+    {
+        this->get((ProbeId)i, &stats);
+        if (stats.calls == 0)
+        {
+            continue;
+        }
+        Serial.printf("%-6s %6u %11.1f %9.1f %9.1f\r\n", PROBE_NAMES[i], stats.calls,
+            stats.total / perMicro / stats.calls, stats.min / perMicro, stats.max / perMicro);
+    }
+}
+
+// Each probe that has been hit as [calls, avg, min, max] in microseconds
+void ProfilerClass::report(JsonObject json)
+{
+    uint32_t perMicro = ticksPerMicro();
+    ProbeStats stats;
+    for (uint8_t i = 0; i < PROBE_COUNT; i++)
+    {
+        this->get((ProbeId)i, &stats);
+        if (stats.calls == 0)
+        {
+            continue;
+        }
+        JsonArray probe = json.createNestedArray(PROBE_NAMES[i]);
+        probe.add(stats.calls);
+        probe.add((uint32_t)(stats.total / perMicro / stats.calls));
+        probe.add(stats.min / perMicro);
+        probe.add(stats.max / perMicro);
+    }
+}
+
+ProfileScope::~ProfileScope()
+{
+    Profiler.record(this->_probe, ProfilerClass::now() - this->_start);
+}
+
+ProfilerClass Profiler;
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+// Set to 1 to build the profiling probes, at 0 PROFILE_SCOPE compiles to nothing
+#define PROFILE_ENABLED 0
+
+#if PROFILE_ENABLED
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+const uint32_t PROFILE_REPORT_MS = 300000;  // How often the probes are printed, sent and cleared
+
+// The functions with a probe in them
+typedef enum {
+    PROBE_READ_DEVICE,      // sensorsClass::readDevice
+    PROBE_DESIRED_UPDATE,   // CloudClass::desiredUpdate
+    PROBE_SEND_MESSAGE,     // CloudClass::sendMessage
+    PROBE_ISO8601,          // NTPUtilityClass::getISO8601Formatted
+    PROBE_LCD_RENDER,       // DisplayClass::render, one frame
+    PROBE_LCD_FIELD,        // DisplayClass::drawField, one field
+    PROBE_COUNT
+} ProbeId;
+
+typedef struct {
+    uint32_t calls;
+    uint64_t total;         // Ticks, cycles on the ESP32
+    uint32_t min;
+    uint32_t max;
+} ProbeStats;
+
+// Call count, total, min and max ticks per probe in a fixed table.  On the ESP32 a tick is
+// a CPU cycle from the core's own counter, so a probe has to start and end on the same core
+// (the loop and display tasks are pinned) and be shorter than one wrap of it (~17s at
+// 240MHz).  Elsewhere it is a nanosecond from the monotonic clock.  Every update is atomic
+// so probes can be hit from both cores without a lock.
+class ProfilerClass
+{
+    public:
+        ProfilerClass();
+        static uint32_t now();
+        static uint32_t ticksPerMicro();
+        void record(ProbeId probe, uint32_t ticks);
+        void get(ProbeId probe, ProbeStats *stats);
+        void clear();
+        void print();
+        void report(JsonObject json);
+    private:
+        ProbeStats _probes[PROBE_COUNT];
+};
+
+// Scope that records how long it was open against a probe, use PROFILE_SCOPE rather than
+// declaring one so it goes away when the probes are turned off
+class ProfileScope
+{
+    public:
+        ProfileScope(ProbeId probe) : _probe(probe), _start(ProfilerClass::now()) {}
+        ~ProfileScope();
+    private:
+        ProbeId _probe;
+        uint32_t _start;
+};
+
+extern ProfilerClass Profiler;
+
+#define PROFILE_JOIN(a, b) a##b
+#define PROFILE_NAME(line) PROFILE_JOIN(_profile_scope_, line)
+#define PROFILE_SCOPE(probe) ProfileScope PROFILE_NAME(__LINE__)(probe)
+
+#else
+
+#define PROFILE_SCOPE(probe)
+
+#endif
+
+#endif
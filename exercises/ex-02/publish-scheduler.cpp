@@ -0,0 +1,225 @@
+#include "publish-scheduler.h"
+#include "trace.h"
+
+// Constructor, every lane starts with a full bucket
+PublishSchedulerClass::PublishSchedulerClass()
+{
+    this->_mux = portMUX_INITIALIZER_UNLOCKED;
+    for (uint8_t i = 0; i < LANE_COUNT; i++)
+    {
+        Lane *lane = &this->_lanes[i];
+        lane->busy = 0;
+        lane->head = 0;
+        lane->count = 0;
+        lane->rate = LANE_RATE[i];
+        lane->burst = LANE_BURST[i];
+        lane->tokens = lane->burst * 1000;
+        lane->refilled = 0;
+        lane->deferring = false;
+    }
+}
+
+// Change the rate limit for a lane
+void PublishSchedulerClass::setLimit(PublishLane lane, uint16_t rate, uint8_t burst)
+{
+    portENTER_CRITICAL(&this->_mux);
+    this->_lanes[lane].rate = rate;
+    this->_lanes[lane].burst = burst;
+    this->_lanes[lane].tokens = min(this->_lanes[lane].tokens, (uint32_t)burst * 1000);
+    portEXIT_CRITICAL(&this->_mux);
+}
+
+// A slot that is neither waiting nor being copied, call with the lock held
+uint8_t PublishSchedulerClass::freeSlot(Lane *lane)
+{
+    uint8_t used = lane->busy;
+    for (uint8_t i = 0; i < lane->count; i++)
+    {
+        used |= 1 << lane->order[(lane->head + i) % LANE_DEPTH];
+    }
+    for (uint8_t slot = 0; slot < LANE_SLOTS; slot++)
+    {
+        if (!(used & (1 << slot)))
+        {
+            return slot;
+        }
+    }
+    return NO_SLOT;
+}
+
+// Add a message to its lane.  A message with the same coalesce key is replaced, otherwise if
+// the lane is full the oldest message is dropped to make room.
+boolean PublishSchedulerClass::queue(PublishLane lane, TopicType topic, const char *payload, uint16_t length, uint8_t key, uint32_t trace)
+{
+    MetricCounter dropped = (MetricCounter)(METRIC_CONTROL_DROPPED + lane);
+    if (length >= CLOUD_MAX_PAYLOAD)
+    {
+        Serial.printf("Dropped a %u byte message, the limit is %u\r\n", length, CLOUD_MAX_PAYLOAD - 1);
+        Metrics.increment(dropped);
+        Trace.close(trace);
+        return false;
+    }
+
+    // Take a slot and fill it without holding the lock
+    Lane *l = &this->_lanes[lane];
+    portENTER_CRITICAL(&this->_mux);
+    uint8_t slot = this->freeSlot(l);
+    if (slot != NO_SLOT)
+    {
+        l->busy |= 1 << slot;
+    }
+    portEXIT_CRITICAL(&this->_mux);
+    if (slot == NO_SLOT)
+    {
+        Serial.println(F("Dropped a message, no free publish slot"));
+        Metrics.increment(dropped);
+        Trace.close(trace);
+        return false;
+    }
+    OutboundMessage *msg = &l->msgs[slot];
+    msg->topic = topic;
+    msg->key = key;
+    msg->trace = trace;
+    msg->length = length;
+    memcpy(msg->payload, payload, length);
+    msg->payload[length] = '\0';
+
+    // Then put it in the queue in place of a waiting one with the same key or at the end
+    // and note the trace of whichever message that pushes out
+    boolean coalesced = false;
+    boolean full = false;
+    uint32_t replaced = NO_TRACE;
+    portENTER_CRITICAL(&this->_mux);
+    if (key != NO_COALESCE)
+    {
+        for (uint8_t i = 0; i < l->count && !coalesced; i++)
+        {
+            uint8_t *waiting = &l->order[(l->head + i) % LANE_DEPTH];
+            if (l->msgs[*waiting].key == key)
+            {
+                replaced = l->msgs[*waiting].trace;
+                *waiting = slot;
+                coalesced = true;
+            }
+        }
+    }
+    if (!coalesced)
+    {
+        if (l->count == LANE_DEPTH)
+        {
+            replaced = l->msgs[l->order[l->head]].trace;
+            l->head = (l->head + 1) % LANE_DEPTH;
+            l->count--;
+            full = true;
+        }
+        l->order[(l->head + l->count) % LANE_DEPTH] = slot;
+        l->count++;
+    }
+    l->busy &= ~(1 << slot);
+    portEXIT_CRITICAL(&this->_mux);
+
+    if (coalesced)
+    {
+        Metrics.increment(METRIC_COALESCED);
+    }
+    if (full)
+    {
+        Metrics.increment(dropped);
+    }
+    Trace.close(replaced);
+    return true;
+}
+
+// Refill the bucket for the time passed and take a token if there is one
+boolean PublishSchedulerClass::takeToken(Lane *lane, uint32_t now)
+{
+    uint32_t full = (uint32_t)lane->burst * 1000;
+    uint32_t elapsed = min(now - lane->refilled, (uint32_t)60000);   // Long idle just means a full bucket
+    lane->tokens = min(full, lane->tokens + elapsed * lane->rate);
+    lane->refilled = now;
+    if (lane->tokens < 1000)
+    {
+        return false;
+    }
+    lane->tokens -= 1000;
+    return true;
+}
+
+// Get the highest priority message that its bucket allows to be sent now
+boolean PublishSchedulerClass::next(OutboundMessage *msg)
+{
+    uint32_t now = millis();
+    Lane *lane = NULL;
+    uint8_t slot = NO_SLOT;
+    int8_t deferred = -1;
+    portENTER_CRITICAL(&this->_mux);
+    for (uint8_t i = 0; i < LANE_COUNT && slot == NO_SLOT; i++)
+    {
+        lane = &this->_lanes[i];
+        if (lane->count == 0)
+        {
+            continue;
+        }
+        if (!this->takeToken(lane, now))
+        {
+            // Only count each held back message once
+            if (!lane->deferring)
+            {
+                lane->deferring = true;
+                deferred = i;
+            }
+            continue;
+        }
+        slot = lane->order[lane->head];
+        lane->busy |= 1 << slot;
+        lane->head = (lane->head + 1) % LANE_DEPTH;
+        lane->count--;
+        lane->deferring = false;
+    }
+    portEXIT_CRITICAL(&this->_mux);
+
+    if (deferred >= 0)
+    {
+        Metrics.increment((MetricCounter)(METRIC_CONTROL_DEFERRED + deferred));
+    }
+    if (slot == NO_SLOT)
+    {
+        return false;
+    }
+    *msg = lane->msgs[slot];
+    portENTER_CRITICAL(&this->_mux);
+    lane->busy &= ~(1 << slot);
+    portEXIT_CRITICAL(&this->_mux);
+    return true;
+}
+
+// How many messages are waiting across all lanes
+uint8_t PublishSchedulerClass::getWaiting()
+{
+    uint8_t waiting = 0;
+    for (uint8_t i = 0; i < LANE_COUNT; i++)
+    {
+        waiting += this->_lanes[i].count;
+    }
+    return waiting;
+}
+
+// How many messages the lane has thrown away
+uint32_t PublishSchedulerClass::getDropped(PublishLane lane)
+{
+    return Metrics.get((MetricCounter)(METRIC_CONTROL_DROPPED + lane));
+}
+
+// How many messages the lane has held back because of the rate limit
+uint32_t PublishSchedulerClass::getDeferred(PublishLane lane)
+{
+    return Metrics.get((MetricCounter)(METRIC_CONTROL_DEFERRED + lane));
+}
+
+// How many messages have been replaced by a newer one with the same key
+uint32_t PublishSchedulerClass::getCoalesced()
+{
+    return Metrics.get(METRIC_COALESCED);
+}
+
+PublishSchedulerClass PublishScheduler;
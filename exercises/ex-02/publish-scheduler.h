@@ -0,0 +1,71 @@
+#ifndef PUBLISH_SCHEDULER_H
+#define PUBLISH_SCHEDULER_H
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "cloud-transport.h"
+#include "metrics.h"
+
+const uint8_t LANE_DEPTH = 4;           // How many messages can wait in each lane
+const uint8_t LANE_SLOTS = LANE_DEPTH + 2;  // Plus one being written by queue() and one being read by next()
+const uint8_t NO_SLOT = 0xFF;
+const uint8_t NO_COALESCE = 0;          // Key for messages that must never be replaced
+
+// Lanes in priority order, the lowest number is always sent first
+typedef enum {
+    CONTROL_LANE,       // Desired state accept/reject
+    STATE_LANE,         // Reported state
+    TELEMETRY_LANE,     // Standard telemetry topic
+    LANE_COUNT
+} PublishLane;
+
+// AWS IoT allows 100 publishes a second per connection and 20 shadow requests a second per thing.
+// Control and state share the shadow limit, telemetry gets most of what is left.
+const uint16_t LANE_RATE[LANE_COUNT] = {10, 10, 80};     // Messages per second
+const uint8_t LANE_BURST[LANE_COUNT] = {10, 5, 20};      // Bucket size
+
+typedef struct {
+    TopicType topic;
+    uint8_t key;
+    uint32_t trace;                     // Trace id, NO_TRACE (0) when it is not followed
+    uint16_t length;
+    char payload[CLOUD_MAX_PAYLOAD];
+} OutboundMessage;
+
+// Outbound messages waiting for the transport.  Each lane has its own token bucket and
+// messages with the same coalesce key replace each other, so only the latest LCD state goes out.
+// The payloads are copied in and out of their slots outside the lock, only the slot numbers
+// are moved about inside it.  The dropped, deferred and coalesced counts are in Metrics.
+class PublishSchedulerClass
+{
+    public:
+        PublishSchedulerClass();
+        boolean queue(PublishLane lane, TopicType topic, const char *payload, uint16_t length, uint8_t key = NO_COALESCE, uint32_t trace = 0);
+        boolean next(OutboundMessage *msg);
+        void setLimit(PublishLane lane, uint16_t rate, uint8_t burst);
+        uint8_t getWaiting();
+        uint32_t getDropped(PublishLane lane);
+        uint32_t getDeferred(PublishLane lane);
+        uint32_t getCoalesced();
+    private:
+        typedef struct {
+            OutboundMessage msgs[LANE_SLOTS];
+            uint8_t order[LANE_DEPTH];  // Slots waiting to be sent, oldest first from head
+            uint8_t busy;               // Bit per slot being written or read outside the lock
+            uint8_t head;
+            uint8_t count;
+            uint32_t tokens;            // Thousandths of a message
+            uint32_t refilled;          // millis() of the last refill
+            uint16_t rate;
+            uint8_t burst;
+            boolean deferring;
+        } Lane;
+        boolean takeToken(Lane *lane, uint32_t now);
+        uint8_t freeSlot(Lane *lane);
+        Lane _lanes[LANE_COUNT];
+        portMUX_TYPE _mux;
+};
+
+extern PublishSchedulerClass PublishScheduler;
+
+#endif
@@ -1,28 +1,15 @@
 #include "sensors.h"
 #include "ntp-utility.h"
-#include <timer.h>
+#include "profile.h"
 
 Adafruit_BMP280 bme;
 
 sensorsClass *pointerToClass;  // Pointer to the class instance so that the ISR function can call it.
-auto _timer = timer_create_default();
-
-// ISR callback function based on interrupt PIN
-static void manualISR(){
-    Serial.println("ISR Triggered....");
-    pointerToClass->isrHandler();
-}
-
-// ISR callback function based on timer interrupt
-static boolean timerFunc(void *){
-    Serial.println("Auto Timer Function....");
-    pointerToClass->read();
-    return true;
-}
 
 // id = the selected device on the Grove plugin.
 sensorsClass::sensorsClass(ScaleType scaleType, uint8_t triggerPin, uint8_t y, uint16_t autoInterval, boolean testing, uint8_t id)
-    :_scaleType(scaleType), _triggerPin(triggerPin), _y(y), _testOnly(testing), _id(id), _autoInterval(autoInterval), _callAuto(autoInterval > 0 ? true: false)
+    :_scaleType(scaleType), _triggerPin(triggerPin), _y(y), _testOnly(testing), _id(id), _autoInterval(autoInterval), _callAuto(autoInterval > 0 ? true: false),
+     _trigger_field(NO_FIELD), _temperature_field(NO_FIELD), _humidity_field(NO_FIELD), _pressure_field(NO_FIELD), _sample_job(NO_JOB), _read_us(0)
 {
 }
 
@@ -45,50 +32,56 @@ void sensorsClass::begin()
     this->_temperature = 0.0;
     this->_pressure = 0.0;
     pointerToClass = this;
-    sensorsClass::_trigger_count = 0;
+    this->_trigger_field = Display.addField("Manual Triggered : ", 0, this->_y, 10);
+    this->_temperature_field = Display.addField("Temperature : ", 0, this->_y + 20, 24);
+    this->_humidity_field = Display.addField("Humidity : ", 0, this->_y + 28, 8);
+    this->_pressure_field = Display.addField("Pressure : ", 0, this->_y + 36, 16);
     sensorsClass::_can_read = false;
     
-    pinMode(this->_triggerPin, INPUT);    
-    attachInterrupt(digitalPinToInterrupt(this->_triggerPin), 
-              manualISR, RISING);
+    // The trigger pin is debounced by the sketch (see debounce.h) which calls triggered() on a press
     if (!bme.begin(0x76))
     {  
         Serial.println("Could not find a valid BMP280 sensor, check wiring!");
         while (1);
     }   
-             
-    if (this->_callAuto)
+
+    if (this->_callAuto && this->_sample_job == NO_JOB)
     {
-        _timer.every(this->_autoInterval, timerFunc);
+        this->_sample_job = Scheduler.every("sample", this->_autoInterval, sampleJob, JOB_HIGH);
     }
 }
 
-// ISR function will call this function to signal that the read function can be called now.
-void sensorsClass::isrHandler()
+// Queue the automatic read the same as the manual trigger, so it is stamped with when it was due
+void sensorsClass::sampleJob()
 {
-    this->_trigger_count++;
+    EventQueue.push(TIMER_EVENT, 0);
+}
+
+// A debounced press of the trigger, signal that the read function can be called now.
+void sensorsClass::triggered()
+{
+    Metrics.increment(METRIC_TRIGGERS);
     this->_can_read = true;
 }
 
 // Signal that the read function can now be called now.
 boolean sensorsClass::canRead()
 {
-    this->tick();
     return this->_can_read;
 }
 
-// Allow the automatic timer to update internal state and cause the trigger to fire if required
-void sensorsClass::tick()
+// Which pin is the manual trigger on
+uint8_t IRAM_ATTR sensorsClass::getTriggerPin()
 {
-    Serial.println("Calling Tick..");
-    _timer.tick();
+    return this->_triggerPin;
 }
 
-// Read the sensor if not in test mode.  
-boolean sensorsClass::read()
+// Read the sensor if not in test mode.  The reading is stamped with the event time if there is one.
+boolean sensorsClass::read(uint64_t eventMs)
 {
     sensorsClass::_can_read = false;
-    this->_lastreading = NTPUtility.getEpoch();
+    this->_lastreading = eventMs > 0 ? eventMs : NTPUtility.getEpochMs();
+    this->_read_us = esp_timer_get_time();
     if (this->_testOnly == false)
     {
         this->_temperature = this->readTemperature();
@@ -111,22 +104,22 @@ boolean sensorsClass::read()
     return true;
 }
 
-// Printout the sensor information to the LCD.  The default background color is black but can be overridden.
+// Update the sensor fields on the display, only the values that changed get redrawn
 void sensorsClass::printStatus()
 {
-    M5.Lcd.setCursor(0, this->_y);
-    M5.Lcd.printf("Manual Triggered : %i\r\n", this->_trigger_count);
-    M5.Lcd.setCursor(0, this->_y + 20);
+    Display.printf(this->_trigger_field, "%u", Metrics.get(METRIC_TRIGGERS));
     // make sure we have sensible information
     if (isnan(this->_temperature) == false)
     {
-        M5.Lcd.printf("Temperature : %2.1f%s    \r\nHumidity : %2.0f%%    \r\nPressure : %2.2f Pa    ", 
-            this->_temperature, this->_symbol.c_str(), this->_humidity, this->_pressure);
+        Display.printf(this->_temperature_field, "%2.1f%s", this->_temperature, this->_symbol.c_str());
+        Display.printf(this->_humidity_field, "%2.0f%%", this->_humidity);
+        Display.printf(this->_pressure_field, "%2.2f Pa", this->_pressure);
     }
     else
     {
-        M5.Lcd.println("Temperature : Invalid Sensor Reading     ");
-        M5.Lcd.println("");
+        Display.setText(this->_temperature_field, "Invalid Sensor Reading");
+        Display.setText(this->_humidity_field, "");
+        Display.setText(this->_pressure_field, "");
     }
 }
 
@@ -154,6 +147,12 @@ uint64_t sensorsClass::getLastRead()
     return this->_lastreading;
 }
 
+// esp_timer time of the last read, for tracing how old a reading is when it is sent
+int64_t sensorsClass::getReadTime()
+{
+    return this->_read_us;
+}
+
 // Get all data as JSON
 JsonObject sensorsClass::toJson()
 {
@@ -163,7 +162,7 @@ JsonObject sensorsClass::toJson()
     root["temp_symbol"] = this->_symbol.c_str();
     root["humidity"] = this->_humidity;
     root["pressure"] = this->_pressure;
-    root["triggered"] = this->_trigger_count;
+    root["triggered"] = Metrics.get(METRIC_TRIGGERS);
     root["last_read"] = this->_lastreading;
     return root;
 }
@@ -171,6 +170,7 @@ JsonObject sensorsClass::toJson()
 // Read the sensor data from the 1 Wire
 byte sensorsClass::readDevice()
 {
+    PROFILE_SCOPE(PROBE_READ_DEVICE);
     Wire.beginTransmission(this->_id);
     Wire.write(0);
     if (Wire.endTransmission()!=0) 
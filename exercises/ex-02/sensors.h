@@ -5,6 +5,10 @@
 #include <Wire.h> //The DHT12 uses 1 Wire comunication.
 #include "Adafruit_Sensor.h"
 #include <Adafruit_BMP280.h>
+#include "event-queue.h"
+#include "display.h"
+#include "job-scheduler.h"
+#include "metrics.h"
 
 typedef enum {
     ENV_CELSIUS = 1,
@@ -23,15 +27,16 @@ class sensorsClass
                    boolean testing = false,   // Should static testing values be used (only require if temp sensor not connected)
                    uint8_t id = 0x5c );          // Identifier of the temp sensor when connected to the grove port.
       void begin();
-      void tick();                          
       boolean canRead();
-      boolean read();
+      boolean read(uint64_t eventMs = 0);
       void printStatus();
-      void isrHandler();
+      void triggered();
+      uint8_t getTriggerPin();
       float getTemperature();
       float getHumidity();
       float getPressure();
       uint64_t getLastRead();
+      int64_t getReadTime();
       JsonObject toJson();
     private:
       uint8_t _id;
@@ -40,19 +45,25 @@ class sensorsClass
       String _symbol;
       uint8_t _triggerPin;
       uint8_t _y;
+      int8_t _trigger_field;
+      int8_t _temperature_field;
+      int8_t _humidity_field;
+      int8_t _pressure_field;
       volatile float _temperature;
       volatile float _humidity;
       volatile float _pressure;
-      volatile unsigned long _trigger_count;
       volatile boolean _can_read;        
       boolean _testOnly;
       byte readDevice();
+      static void sampleJob();
       boolean _callAuto;
       uint16_t _autoInterval;
+      int8_t _sample_job;                 // Scheduler job that queues the automatic read
       float readTemperature();
       float readHumidity(); 
       float readPressure();     
-      uint64_t _lastreading;  
+      uint64_t _lastreading;              // Epoch in ms
+      int64_t _read_us;                   // esp_timer when the sensor was actually read
 };
 
 #endif
@@ -0,0 +1,159 @@
+#include "sparkline.h"
+
+// Constructor
+SparklineClass::SparklineClass(int16_t x, int16_t y, uint16_t width, uint8_t height, uint16_t colour)
+    : _sprite(NULL), _x(x), _y(y), _width(min(width, SPARKLINE_MAX_WIDTH)), _height(height), _colour(colour),
+      _background(BLACK), _head(0), _count(0), _min(0), _max(0), _rescale(true), _dirty(true)
+{
+}
+
+// Create the off screen copy of the chart, call after M5.begin
+void SparklineClass::begin(uint16_t background)
+{
+    this->_background = background;
+    this->_sprite = new TFT_eSprite(&M5.Lcd);
+    this->_sprite->setColorDepth(8);
+    if (this->_sprite->createSprite(this->_width, this->_height) == NULL)
+    {
+        Serial.println(F("No memory for the sparkline"));
+        delete this->_sprite;
+        this->_sprite = NULL;
+        return;
+    }
+    this->_sprite->setScrollRect(0, 0, this->_width, this->_height, this->_background);
+    this->_sprite->fillSprite(this->_background);
+}
+
+// Add a sample.  The min/max only needs a full scan when the sample dropping off was one of them.
+void SparklineClass::add(float value)
+{
+    if (isnan(value))
+    {
+        return;
+    }
+    float oldest = this->_values[this->_head];
+    boolean full = this->_count == this->_width;
+    this->_values[this->_head] = value;
+    this->_head = (this->_head + 1) % this->_width;
+
+    float previousMin = this->_min;
+    float previousMax = this->_max;
+    if (this->_count == 0)
+    {
+        this->_min = value;
+        this->_max = value;
+    }
+    else if (full && (oldest <= this->_min || oldest >= this->_max))
+    {
+        this->rescan();
+    }
+    else
+    {
+        this->_min = min(this->_min, value);
+        this->_max = max(this->_max, value);
+    }
+    if (!full)
+    {
+        this->_count++;
+    }
+
+    if (this->_min != previousMin || this->_max != previousMax)
+    {
+        this->_rescale = true;
+    }
+    else if (this->_sprite != NULL && !this->_rescale)
+    {
+        // Same scale so move everything along and draw the new column only
+        this->_sprite->scroll(-1, 0);
+        this->drawColumn(this->_width - 1, this->_count - 1);
+    }
+    this->_dirty = true;
+}
+
+// Send the chart to the LCD if it changed
+void SparklineClass::render()
+{
+    if (this->_sprite == NULL || !this->_dirty)
+    {
+        return;
+    }
+    if (this->_rescale)
+    {
+        this->redraw();
+    }
+    this->_sprite->pushSprite(this->_x, this->_y);
+    this->_dirty = false;
+}
+
+// The screen under the chart was cleared, send it again at the next render
+void SparklineClass::invalidate()
+{
+    this->_dirty = true;
+}
+
+// Smallest sample in the chart
+float SparklineClass::getMin()
+{
+    return this->_min;
+}
+
+// Largest sample in the chart
+float SparklineClass::getMax()
+{
+    return this->_max;
+}
+
+// How many samples are in the chart
+uint16_t SparklineClass::getCount()
+{
+    return this->_count;
+}
+
+// Sample by age, 0 is the oldest
+float SparklineClass::valueAt(uint16_t index)
+{
+    uint16_t oldest = (this->_head + this->_width - this->_count) % this->_width;
+    return this->_values[(oldest + index) % this->_width];
+}
+
+// Row for a value, the top row is the max
+int16_t SparklineClass::scale(float value)
+{
+    if (this->_max <= this->_min)
+    {
+        return this->_height / 2;
+    }
+    return (this->_height - 1) - (int16_t)((value - this->_min) * (this->_height - 1) / (this->_max - this->_min));
+}
+
+// Work out the min/max again from every sample
+void SparklineClass::rescan()
+{
+    this->_min = this->_max = this->valueAt(0);
+    for (uint16_t i = 1; i < this->_count; i++)
+    {
+        float value = this->valueAt(i);
+        this->_min = min(this->_min, value);
+        this->_max = max(this->_max, value);
+    }
+}
+
+// Draw a sample as a line from the previous sample so steps stay joined up
+void SparklineClass::drawColumn(int16_t x, uint16_t index)
+{
+    int16_t y = this->scale(this->valueAt(index));
+    int16_t from = index > 0 ? this->scale(this->valueAt(index - 1)) : y;
+    this->_sprite->drawFastVLine(x, min(y, from), abs(y - from) + 1, this->_colour);
+}
+
+// Scale has changed so draw every column again, newest on the right
+void SparklineClass::redraw()
+{
+    this->_sprite->fillSprite(this->_background);
+    int16_t x = this->_width - this->_count;
+    for (uint16_t i = 0; i < this->_count; i++)
+    {
+        this->drawColumn(x + i, i);
+    }
+    this->_rescale = false;
+}
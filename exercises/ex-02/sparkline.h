@@ -0,0 +1,44 @@
+#ifndef SPARKLINE_H
+#define SPARKLINE_H
+
+#include <M5Stack.h>
+
+const uint16_t SPARKLINE_MAX_WIDTH = 128;   // Samples kept, one per column
+
+// Scrolling chart of the recent samples of one value.  A new sample scrolls the chart
+// one column left and only the new column is drawn, the whole chart is only redrawn when
+// the running min/max (and so the scale) changes.
+class SparklineClass
+{
+    public:
+        SparklineClass(int16_t x, int16_t y, uint16_t width, uint8_t height, uint16_t colour);
+        void begin(uint16_t background);
+        void add(float value);
+        void render();
+        void invalidate();
+        float getMin();
+        float getMax();
+        uint16_t getCount();
+    private:
+        int16_t scale(float value);
+        void rescan();
+        void drawColumn(int16_t x, uint16_t index);
+        void redraw();
+        float valueAt(uint16_t index);
+        TFT_eSprite *_sprite;
+        int16_t _x;
+        int16_t _y;
+        uint16_t _width;
+        uint8_t _height;
+        uint16_t _colour;
+        uint16_t _background;
+        float _values[SPARKLINE_MAX_WIDTH];
+        uint16_t _head;                 // Where the next sample goes
+        uint16_t _count;
+        float _min;
+        float _max;
+        boolean _rescale;               // Scale changed so every column needs drawing again
+        boolean _dirty;                 // Sprite has changed since it was last pushed
+};
+
+#endif
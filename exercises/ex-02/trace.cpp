@@ -0,0 +1,157 @@
+#include "trace.h"
+
+// Constructor
+TraceClass::TraceClass()
+    : _next_id(1), _acked(0), _abandoned(0), _dropped(0)
+{
+    this->_mux = portMUX_INITIALIZER_UNLOCKED;
+    memset(this->_open, 0, sizeof(this->_open));
+}
+
+// Start following a message, call when its document has been built.  The sample time is
+// when the reading in it was taken.  Returns the id to pass along with the message.
+uint32_t TraceClass::open(int64_t sampleUs)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&this->_mux);
+    uint32_t id = this->_next_id++;
+    if (this->_next_id == NO_TRACE)
+    {
+        this->_next_id = 1;
+    }
+    TraceRecord *trace = &this->_open[id % TRACE_MAX_OPEN];
+    if (trace->id != NO_TRACE && trace->acked && trace->at[TRACE_ACK] == 0)
+    {
+        this->_abandoned++;
+    }
+    memset(trace, 0, sizeof(TraceRecord));
+    trace->id = id;
+    trace->at[TRACE_SAMPLE] = sampleUs > 0 && sampleUs <= now ? sampleUs : now;
+    this->record(trace, TRACE_BUILD);
+    portEXIT_CRITICAL(&this->_mux);
+    return id;
+}
+
+// The transport will ack this one, so not hearing back counts
+void TraceClass::expectAck(uint32_t id)
+{
+    portENTER_CRITICAL(&this->_mux);
+    TraceRecord *trace = &this->_open[id % TRACE_MAX_OPEN];
+    if (trace->id == id)
+    {
+        trace->acked = true;
+    }
+    portEXIT_CRITICAL(&this->_mux);
+}
+
+// A message has reached a stage.  Ignored if it is no longer being followed.
+void TraceClass::mark(uint32_t id, TraceStage stage)
+{
+    if (id == NO_TRACE)
+    {
+        return;
+    }
+    portENTER_CRITICAL(&this->_mux);
+    TraceRecord *trace = &this->_open[id % TRACE_MAX_OPEN];
+    if (trace->id == id && trace->at[stage] == 0)
+    {
+        this->record(trace, stage);
+        if (stage == TRACE_ACK)
+        {
+            this->_acked++;
+        }
+    }
+    portEXIT_CRITICAL(&this->_mux);
+}
+
+// Stamp a stage and count the time since the one before it.  The stages up to serialize
+// are microseconds, from the socket on the network is involved so they are milliseconds.
+void TraceClass::record(TraceRecord *trace, TraceStage stage)
+{
+    int64_t now = esp_timer_get_time();
+    trace->at[stage] = now;
+    switch (stage)
+    {
+        case TRACE_BUILD:
+            Metrics.observe(METRIC_TRACE_AGE, (now - trace->at[TRACE_SAMPLE]) / 1000);
+            break;
+        case TRACE_SERIALIZE:
+            Metrics.observe(METRIC_TRACE_SERIALIZE, now - trace->at[TRACE_BUILD]);
+            break;
+        case TRACE_WRITE:
+            Metrics.observe(METRIC_TRACE_WRITE, (now - trace->at[TRACE_SERIALIZE]) / 1000);
+            Metrics.observe(METRIC_TRACE_SENT, (now - trace->at[TRACE_SAMPLE]) / 1000);
+            break;
+        case TRACE_ACK:
+            Metrics.observe(METRIC_TRACE_ACK, (now - trace->at[TRACE_WRITE]) / 1000);
+            Metrics.observe(METRIC_TRACE_TOTAL, (now - trace->at[TRACE_SAMPLE]) / 1000);
+            break;
+        default:
+            break;
+    }
+}
+
+// Look for the clientToken in a shadow response and ack that trace.  Only scans the text,
+// the response is not worth parsing just for this.
+boolean TraceClass::ack(const char *payload, unsigned int length)
+{
+    const char *end = payload + length;
+    size_t keyLength = strlen(TRACE_TOKEN_KEY);
+    for (const char *p = payload; p + keyLength < end; p++)
+    {
+        if (memcmp(p, TRACE_TOKEN_KEY, keyLength) == 0)
+        {
+            uint32_t id = 0;
+            for (p += keyLength; p < end && *p >= '0' && *p <= '9'; p++)
+            {
+                id = id * 10 + (*p - '0');
+            }
+            this->mark(id, TRACE_ACK);
+            return id != NO_TRACE;
+        }
+    }
+    return false;
+}
+
+// The message was dropped or replaced before it was sent, stop following it
+void TraceClass::close(uint32_t id)
+{
+    if (id == NO_TRACE)
+    {
+        return;
+    }
+    portENTER_CRITICAL(&this->_mux);
+    TraceRecord *trace = &this->_open[id % TRACE_MAX_OPEN];
+    if (trace->id == id)
+    {
+        trace->id = NO_TRACE;
+        this->_dropped++;
+    }
+    portEXIT_CRITICAL(&this->_mux);
+}
+
+// How many messages have been traced
+uint32_t TraceClass::getOpened()
+{
+    return this->_next_id - 1;
+}
+
+// How many were acked by the broker
+uint32_t TraceClass::getAcked()
+{
+    return this->_acked;
+}
+
+// How many that should have been acked were not before their slot was needed again
+uint32_t TraceClass::getAbandoned()
+{
+    return this->_abandoned;
+}
+
+// How many were closed because the message never went
+uint32_t TraceClass::getDropped()
+{
+    return this->_dropped;
+}
+
+TraceClass Trace;
@@ -0,0 +1,60 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "metrics.h"
+
+const uint8_t TRACE_MAX_OPEN = 8;           // Messages followed at once, the oldest is given up on
+const uint32_t NO_TRACE = 0;
+const boolean TRACE_IN_PAYLOAD = true;      // Put the trace id in the message so the backend can work out the ingestion lag
+const char TRACE_TOKEN_KEY[] = "\"clientToken\":\"";
+
+typedef enum {
+    TRACE_SAMPLE,       // Sensor read
+    TRACE_BUILD,        // Document built
+    TRACE_SERIALIZE,    // JSON text ready and queued
+    TRACE_WRITE,        // Handed to the socket by the transport
+    TRACE_ACK,          // Broker accepted it (shadow update/accepted)
+    TRACE_STAGE_COUNT
+} TraceStage;
+
+typedef struct {
+    uint32_t id;
+    int64_t at[TRACE_STAGE_COUNT];      // esp_timer time of each stage, 0 until it happens
+    boolean acked;                      // Will the broker ack it
+} TraceRecord;
+
+// Follows a message from the sensor read to the broker.  open() starts a trace when the
+// document is built and mark() records the later stages from whichever task gets there, the
+// time between stages goes into the METRIC_TRACE_* histograms.  A message that never leaves
+// the publish lanes is closed by them so it does not hold its slot.  Telemetry is QoS 0 with
+// PubSubClient so the socket write is as far as it can be followed, shadow updates carry the
+// id as their clientToken and are acked when update/accepted echoes it back.
+class TraceClass
+{
+    public:
+        TraceClass();
+        uint32_t open(int64_t sampleUs);
+        void expectAck(uint32_t id);
+        void mark(uint32_t id, TraceStage stage);
+        boolean ack(const char *payload, unsigned int length);
+        void close(uint32_t id);
+        uint32_t getOpened();
+        uint32_t getAcked();
+        uint32_t getAbandoned();
+        uint32_t getDropped();
+    private:
+        void record(TraceRecord *trace, TraceStage stage);
+        TraceRecord _open[TRACE_MAX_OPEN];
+        uint32_t _next_id;
+        uint32_t _acked;
+        uint32_t _abandoned;            // Never acked before its slot was needed
+        uint32_t _dropped;              // Messages the publish lanes threw away or replaced
+        portMUX_TYPE _mux;
+};
+
+extern TraceClass Trace;
+
+#endif
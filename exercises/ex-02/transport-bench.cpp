@@ -0,0 +1,116 @@
+#include "transport-bench.h"
+#include <ArduinoJson.h>
+#include "aws-iot.h"
+#include "cloud.h"
+#include "broker-stub.h"
+#include "device-config.h"
+
+// A typical telemetry message from buildMessageAndSend
+static const char BENCH_PAYLOAD[] = "{\"device\":\"On\",\"telemetry\":{\"temperature\":23.3,\"temp_symbol\":\"C\","
+                                    "\"humidity\":45.5,\"pressure\":10856.0,\"triggered\":0,\"last_read\":1571500800000},"
+                                    "\"location\":{\"room\":\"Kitchen\"},\"msg_number\":1,\"timestamp\":1571500800000}";
+
+static volatile uint32_t brokerReceived;      // When the broker last saw a publish
+static volatile uint32_t shadowReceived;      // How many shadow updates the broker has seen
+
+// Called by the broker stub for every publish from the device
+static void brokerHook(const char *topic, const byte *payload, uint16_t length)
+{
+    brokerReceived = micros();
+    if (strcmp(topic, DeviceConfig.getShadowTopic()) == 0)
+    {
+        shadowReceived++;
+    }
+}
+
+static int compareSamples(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// Sort the samples and pick the requested percentile
+uint32_t TransportBenchClass::percentile(uint32_t *samples, uint16_t count, uint8_t pct)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    qsort(samples, count, sizeof(uint32_t), compareSamples);
+    return samples[((uint32_t)(count - 1) * pct) / 100];
+}
+
+// Run the publish and delta round trip benchmarks.  Must be called instead of the
+// normal connection as AWSIoT is left pointing at the broker stub.
+void TransportBenchClass::run(TWINUPDATECALLBACK callback)
+{
+    StaticJsonDocument<384> result;
+    result["bench"] = "aws-broker-stub";
+
+    // Lift the rate limits so the results are for the code and not the token buckets
+    for (uint8_t lane = 0; lane < LANE_COUNT; lane++)
+    {
+        PublishScheduler.setLimit((PublishLane)lane, 60000, 255);
+    }
+
+    BrokerStub.setPublishHook(brokerHook);
+    AWSIoT.useClient(BrokerStub);
+    Cloud.begin(&AWSIoT, callback);
+    if (!Cloud.connect())
+    {
+        result["error"] = "connect failed";
+        serializeJson(result, Serial);
+        Serial.println();
+        return;
+    }
+
+    // Publish throughput and latency (call to the broker seeing the packet)
+    uint16_t published = 0;
+    uint32_t start = micros();
+    for (uint16_t i = 0; i < BENCH_MESSAGES; i++)
+    {
+        uint32_t t0 = micros();
+        if (AWSIoT.publishNow(TELEMETRY_TOPIC, BENCH_PAYLOAD))
+        {
+            this->_publish_us[published++] = brokerReceived - t0;
+        }
+    }
+    uint32_t elapsed = micros() - start;
+
+    // Delta in to shadow acknowledgement out, through the full desiredUpdate path
+    uint8_t deltas = 0;
+    char delta[64];
+    for (uint8_t i = 0; i < BENCH_DELTAS; i++)
+    {
+        snprintf(delta, sizeof(delta), "{\"state\":{\"send_interval\":%u}}", 10000 + (i + 1) * 1000);
+        uint32_t acks = shadowReceived;
+        uint32_t t0 = micros();
+        if (!BrokerStub.injectDelta(delta))
+        {
+            continue;
+        }
+        while (shadowReceived == acks && (micros() - t0) < BENCH_DELTA_TIMEOUT_US)
+        {
+            Cloud.checkForMessage();
+        }
+        if (shadowReceived != acks)
+        {
+            this->_delta_us[deltas++] = micros() - t0;
+        }
+    }
+
+    result["messages"] = published;
+    result["payload_bytes"] = strlen(BENCH_PAYLOAD);
+    result["elapsed_us"] = elapsed;
+    result["throughput_mps"] = elapsed > 0 ? (published * 1000000.0) / elapsed : 0;
+    result["publish_p50_us"] = this->percentile(this->_publish_us, published, 50);
+    result["publish_p99_us"] = this->percentile(this->_publish_us, published, 99);
+    result["deltas"] = deltas;
+    result["delta_ack_p50_us"] = this->percentile(this->_delta_us, deltas, 50);
+    result["delta_ack_p99_us"] = this->percentile(this->_delta_us, deltas, 99);
+    serializeJson(result, Serial);
+    Serial.println();
+}
+
+TransportBenchClass TransportBench;
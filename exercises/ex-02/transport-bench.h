@@ -0,0 +1,25 @@
+#ifndef TRANSPORT_BENCH_H
+#define TRANSPORT_BENCH_H
+
+#include <Arduino.h>
+#include "callbacks.h"
+
+const uint16_t BENCH_MESSAGES = 256;          // Telemetry publishes to time
+const uint8_t BENCH_DELTAS = 32;              // Shadow delta round trips to time
+const uint32_t BENCH_DELTA_TIMEOUT_US = 2000000;
+
+// Drives the real AWSIoTClass/PubSubClient code against the in-process broker stub and
+// prints the results as a single JSON line on the serial port.
+class TransportBenchClass
+{
+    public:
+        void run(TWINUPDATECALLBACK callback);
+    private:
+        uint32_t percentile(uint32_t *samples, uint16_t count, uint8_t pct);
+        uint32_t _publish_us[BENCH_MESSAGES];
+        uint32_t _delta_us[BENCH_DELTAS];
+};
+
+extern TransportBenchClass TransportBench;
+
+#endif
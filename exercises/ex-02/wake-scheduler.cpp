@@ -0,0 +1,91 @@
+#include "wake-scheduler.h"
+
+// Constructor
+WakeSchedulerClass::WakeSchedulerClass()
+    : _task(NULL), _next(0), _waits(0), _woken(0), _idle_ms(0)
+{
+}
+
+// Remember the task that waits, call from setup() so it is the loop task
+void WakeSchedulerClass::begin()
+{
+    this->_task = xTaskGetCurrentTaskHandle();
+    this->_next = millis() + WAKE_MAX_IDLE_MS;
+}
+
+// Come back round within ms, for things that are polled such as a reply being waited on
+void WakeSchedulerClass::after(uint32_t ms)
+{
+    this->until(millis() + ms);
+}
+
+// Keep the soonest deadline
+void WakeSchedulerClass::until(uint32_t when)
+{
+    if ((int32_t)(when - this->_next) < 0)
+    {
+        this->_next = when;
+    }
+}
+
+// End the wait now, safe from an ISR or any task
+void IRAM_ATTR WakeSchedulerClass::wake()
+{
+    if (this->_task == NULL)
+    {
+        return;
+    }
+    if (xPortInIsrContext())
+    {
+        BaseType_t higherPriorityWoken = pdFALSE;
+        vTaskNotifyGiveFromISR(this->_task, &higherPriorityWoken);
+        if (higherPriorityWoken)
+        {
+            portYIELD_FROM_ISR();
+        }
+    }
+    else
+    {
+        xTaskNotifyGive(this->_task);
+    }
+}
+
+// Block until the soonest deadline or a wake, the idle task runs in the meantime.
+// Returns how long it waited.
+uint32_t WakeSchedulerClass::wait()
+{
+    uint32_t start = millis();
+    int32_t remaining = (int32_t)(this->_next - start);
+    if (remaining > 0)
+    {
+        this->_waits++;
+        if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(remaining)) > 0)
+        {
+            this->_woken++;
+        }
+    }
+    uint32_t now = millis();
+    this->_idle_ms += now - start;
+    this->_next = now + WAKE_MAX_IDLE_MS;
+    return now - start;
+}
+
+// How many times the loop has waited
+uint32_t WakeSchedulerClass::getWaits()
+{
+    return this->_waits;
+}
+
+// How many waits were ended by an event rather than a deadline
+uint32_t WakeSchedulerClass::getWoken()
+{
+    return this->_woken;
+}
+
+// Total time the loop has spent waiting
+uint64_t WakeSchedulerClass::getIdleMs()
+{
+    return this->_idle_ms;
+}
+
+WakeSchedulerClass WakeScheduler;
@@ -0,0 +1,35 @@
+#ifndef WAKE_SCHEDULER_H
+#define WAKE_SCHEDULER_H
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+const uint32_t WAKE_MAX_IDLE_MS = 1000;       // Never wait longer than this even with nothing due
+
+// Replaces the fixed delay() at the end of loop().  Each pass the modules and the job scheduler
+// say when they next need the loop through after(), then wait() blocks the loop task until the
+// soonest of those or until an ISR or another task calls wake().
+class WakeSchedulerClass
+{
+    public:
+        WakeSchedulerClass();
+        void begin();
+        void after(uint32_t ms);
+        void wake();
+        uint32_t wait();
+        uint32_t getWaits();
+        uint32_t getWoken();
+        uint64_t getIdleMs();
+    private:
+        void until(uint32_t when);
+        TaskHandle_t _task;
+        uint32_t _next;                 // millis() of the soonest deadline this pass
+        uint32_t _waits;
+        uint32_t _woken;                // Waits ended early by wake()
+        uint64_t _idle_ms;
+};
+
+extern WakeSchedulerClass WakeScheduler;
+
+#endif
@@ -5,12 +5,27 @@
 
 const uint8_t disconnect = 30;
 
+// Constructor
+wifiConnectClass::wifiConnectClass()
+    : _connected(false), _ssid_field(NO_FIELD), _type_field(NO_FIELD), _status_field(NO_FIELD), _ip_field(NO_FIELD)
+{
+}
+
+// Put the WiFi fields on the display
+void wifiConnectClass::addFields()
+{
+    this->_ssid_field = Display.addField("Access Point is ", 0, 0, 32);
+    this->_type_field = Display.addField("Using ", 0, 8, 16);
+    this->_status_field = Display.addField("WiFi is ", 0, 16, 16);
+    this->_ip_field = Display.addField("IP address: ", 0, 24, 16);
+}
+
 // Printout the current WiFi information
 void wifiConnectClass::printHeader()
 {
-    M5.Lcd.setCursor(0,0);      
-    M5.Lcd.printf("Access Point is %s\r\n", this->_ssid.c_str());
-    M5.Lcd.printf("Using %s WiFi\r\n", (this->_type == Public ? F("Public") : F("Enterprise")));  
+    Display.setText(this->_ssid_field, this->_ssid.c_str());
+    Display.setText(this->_type_field, this->_type == Public ? "Public WiFi" : "Enterprise WiFi");
+    Display.publish();
 }
 
 // Initialise the hotspot AP
@@ -20,6 +35,7 @@ void wifiConnectClass::begin(const char *ssid, const char *ssid_pwd)
     this->_ssid_pwd = String(ssid_pwd);    
     WiFi.disconnect();
     WiFi.mode(WIFI_AP_STA);
+    this->addFields();
     this->_type = Public;
     this->printHeader();
 }
@@ -32,6 +48,7 @@ void wifiConnectClass::begin(const char *ssid, const char *user_name, const char
     this->_user_pwd = user_pwd;   
     WiFi.disconnect();
     WiFi.mode(WIFI_STA);
+    this->addFields();
     esp_wifi_sta_wpa2_ent_set_identity((uint8_t *)EAP_ANONYMOUS_IDENTITY, strlen(EAP_ANONYMOUS_IDENTITY)); 
     esp_wifi_sta_wpa2_ent_set_username((uint8_t *)this->_user.c_str(), this->_user.length());
     esp_wifi_sta_wpa2_ent_set_password((uint8_t *)this->_user_pwd.c_str(), this->_user_pwd.length());
@@ -41,14 +58,14 @@ void wifiConnectClass::begin(const char *ssid, const char *user_name, const char
     this->printHeader();
 }
 
-// Do the actual connection to the AP
-boolean wifiConnectClass::connect()
+// Do the actual connection to the AP.  A known channel/BSSID skips the scan for a faster reconnect.
+boolean wifiConnectClass::connect(int32_t channel, const uint8_t *bssid)
 {
     uint8_t loop = 0;
     this->_connected = false;
     switch(this->_type){
         case Public:
-            WiFi.begin(this->_ssid.c_str(), this->_ssid_pwd.c_str());
+            WiFi.begin(this->_ssid.c_str(), this->_ssid_pwd.c_str(), channel, bssid);
             break;
         case Enterprise:
             WiFi.begin(this->_ssid.c_str()); //connect to wifi
@@ -75,14 +92,13 @@ boolean wifiConnectClass::connect()
 // Print out the current status of the WiFi connection the IPv4 address
 void wifiConnectClass::printStatus()
 {
-    M5.Lcd.setCursor(0,0);    
-    M5.Lcd.printf("Access Point is %s\r\n", this->_ssid.c_str());
-    M5.Lcd.printf("Using %s WiFi\r\n", (this->_type == Public ? F("Public") : F("Enterprise")));      
-    M5.Lcd.printf("WiFi is %s\r\n", this->_connected ? F("Connected") : F("NOT Connected"));
+    Display.setText(this->_ssid_field, this->_ssid.c_str());
+    Display.setText(this->_type_field, this->_type == Public ? "Public WiFi" : "Enterprise WiFi");
+    Display.setText(this->_status_field, this->_connected ? "Connected" : "NOT Connected");
     if (this->_connected)
     {
-        M5.Lcd.printf("IP address: %s\r\n", WiFi.localIP().toString().c_str());
-    }    
+        Display.setText(this->_ip_field, WiFi.localIP().toString().c_str());
+    }
 }
 
 // Are we connected to the AP or not
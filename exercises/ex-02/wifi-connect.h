@@ -4,6 +4,7 @@
 #include <Arduino.h>
 #include <WiFi.h>
 #include "esp_wpa2.h"
+#include "display.h"
 
 typedef enum {
     Public,
@@ -13,13 +14,19 @@ typedef enum {
 class wifiConnectClass
 {
     public:
+        wifiConnectClass();
         void begin(const char* ssid, const char* ssid_pwd);
         void begin(const char* ssid, const char* user_name, const char* user_pwd);
-        boolean connect();
+        boolean connect(int32_t channel = 0, const uint8_t *bssid = NULL);
         void printStatus();        
         boolean isConnected();
     private:
         void printHeader();
+        void addFields();
+        int8_t _ssid_field;
+        int8_t _type_field;
+        int8_t _status_field;
+        int8_t _ip_field;
         boolean _connected;
         ConnectType _type;
         String _ssid;
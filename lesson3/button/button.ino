@@ -5,22 +5,35 @@
 
 const uint8_t TRIGGER_PIN = 39;  // PIN number for the left button
 volatile int trigger_count = 0;  // Need volatile as the variable could be read as it is being updated by the ISR  
+int shown_count = -1;            // What is on the screen, only the loop draws to the LCD
+const unsigned long DEBOUNCE_US = 50000;   // Edges this close to the last one are contact bounce
+volatile unsigned long last_trigger_us = 0;
 
 // REMEMBER alway declare a function before using it.
+// Drawing to the LCD takes a long time over SPI so it is done from the loop, never from the ISR
 void print_count()
 { 
-    Serial.println("ISR Started");
+    int count = trigger_count;    // Take a copy as the ISR can change it at any time
+    if (count == shown_count)
+    {
+        return;
+    }
     M5.Lcd.setCursor(0, 0);  
-    M5.Lcd.printf("Triggered : %i\r\n", trigger_count);
-    //delay(5000);  //Uncomment to see what happens when you try to use Interrupt within an Interrupt
-    Serial.println("ISR Finished...");
+    M5.Lcd.printf("Triggered : %i\r\n", count);
+    shown_count = count;
 }
 
 // ISR Callback Function - Must NOT HAVE ANY PARAMETERS and Global/Static
-void isr_triggered()
+// Keep it short, just record what happened and let the loop do the work
+void IRAM_ATTR isr_triggered()
 {
+    unsigned long now = micros();
+    if ((now - last_trigger_us) < DEBOUNCE_US)
+    {
+        return;        // Still bouncing from the last trigger so ignore it
+    }
+    last_trigger_us = now;
     trigger_count++;   // Incrementation Counter
-    print_count();
 }
 
 // Initialise the sketch - Only called once on start
@@ -39,4 +52,6 @@ void setup()
 
 void loop()
 {
+    print_count();
+    delay(50);
 }
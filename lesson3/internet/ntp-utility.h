@@ -6,9 +6,9 @@
 #include <WiFiUdp.h>
 #include <NTPClient.h>
 
-#ifndef LEAP_YEAR
-#define LEAP_YEAR(Y)     ( (Y>0) && !(Y%4) && ( (Y%100) || !(Y%400) ) )
-#endif
+const uint8_t NTP_DATE_SIZE = 11;       // YYYY-MM-DD plus terminator
+const uint8_t NTP_TIME_SIZE = 9;        // HH:MM:SS plus terminator
+const uint8_t NTP_ISO8601_SIZE = 21;    // YYYY-MM-DDTHH:MM:SSZ plus terminator
 
 class NTPUtilityClass 
 {
@@ -18,10 +18,16 @@ class NTPUtilityClass
         String getFormattedDate();
         String getISO8601Formatted();
         String getFormattedTime();
+        size_t getFormattedDate(char *buffer, size_t size);
+        size_t getISO8601Formatted(char *buffer, size_t size);
+        size_t getFormattedTime(char *buffer, size_t size);
         void tick();
         long getEpoch();
     private:
+        void updateDate(unsigned long epoch);
         NTPClient _ntp;
+        uint32_t _date_day;             // Day the cached date is for
+        char _date[NTP_DATE_SIZE];      // Cached YYYY-MM-DD
 };
 
 extern NTPUtilityClass NTPUtility;
@@ -2,9 +2,38 @@
 
 WiFiUDP ntpUDP;
 
+// Convert days since 1970-01-01 to the civil date in constant time.
+// Based on http://howardhinnant.github.io/date_algorithms.html#civil_from_days
+static void civilFromDays(uint32_t days, uint16_t *year, uint8_t *month, uint8_t *day)
+{
+    uint32_t z = days + 719468;                 // Shift the epoch to 0000-03-01
+    uint32_t era = z / 146097;                  // 400 year eras
+    uint32_t doe = z - era * 146097;            // Day of era [0, 146096]
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;          // March is month 0
+    *day = doy - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 3 : mp - 9;
+    *year = yoe + era * 400 + (*month <= 2 ? 1 : 0);
+}
+
+// Write a zero padded number without going through printf
+static char *writeDigits(char *out, uint32_t value, uint8_t width)
+{
+    for (int8_t i = width - 1; i >= 0; i--)
+    {
+        out[i] = '0' + (value % 10);
+        value /= 10;
+    }
+    return out + width;
+}
+
 NTPUtilityClass::NTPUtilityClass()
-    :_ntp(ntpUDP, "pool.ntp.org") // Default NTP site
-    {}
+    :_ntp(ntpUDP, "pool.ntp.org"), // Default NTP site
+     _date_day(0xFFFFFFFF)
+    {
+        this->_date[0] = '\0';
+    }
 
 void NTPUtilityClass::begin()
 {
@@ -12,43 +41,94 @@ void NTPUtilityClass::begin()
     this->_ntp.update();
 }
 
-String NTPUtilityClass::getFormattedDate()  // Convert epoch time to date - Surprising not part of NTPClient Package!
+void NTPUtilityClass::updateDate(unsigned long epoch)   // Only work out the date when the day changes
+{
+    uint32_t days = epoch / 86400L;
+    if (days == this->_date_day)
+    {
+        return;
+    }
+    uint16_t year;
+    uint8_t month, day;
+    civilFromDays(days, &year, &month, &day);
+    char *out = writeDigits(this->_date, year, 4);
+    *out++ = '-';
+    out = writeDigits(out, month, 2);
+    *out++ = '-';
+    out = writeDigits(out, day, 2);
+    *out = '\0';
+    this->_date_day = days;
+}
+
+size_t NTPUtilityClass::getFormattedDate(char *buffer, size_t size)   // Convert epoch time to date - Surprising not part of NTPClient Package!
 {
-    unsigned long rawTime = this->_ntp.getEpochTime() / 86400L;  // in days
-    unsigned long days = 0, year = 1970;
-    uint8_t month;
-    static const uint8_t monthDays[]={31,28,31,30,31,30,31,31,30,31,30,31};
+    if (size < NTP_DATE_SIZE)
+    {
+        return 0;
+    }
+    this->updateDate(this->_ntp.getEpochTime());
+    memcpy(buffer, this->_date, NTP_DATE_SIZE);
+    return NTP_DATE_SIZE - 1;
+}
 
-    while((days += (LEAP_YEAR(year) ? 366 : 365)) <= rawTime)
-        year++;
-      
-    rawTime -= days - (LEAP_YEAR(year) ? 366 : 365); // now it is days in this year, starting at 0
-    days=0;
-    for (month=0; month<12; month++) {
-        uint8_t monthLength;
-        if (month==1) 
-        { // february
-            monthLength = LEAP_YEAR(year) ? 29 : 28;
-        } else {
-            monthLength = monthDays[month];
-        }
-        if (rawTime < monthLength) break;
-        rawTime -= monthLength;
+size_t NTPUtilityClass::getFormattedTime(char *buffer, size_t size)   // Convert epoch time to HH:MM:SS
+{
+    if (size < NTP_TIME_SIZE)
+    {
+        return 0;
     }
-    String monthStr = ++month < 10 ? "0" + String(month) : String(month); // jan is month 1  
-    String dayStr = ++rawTime < 10 ? "0" + String(rawTime) : String(rawTime); // day of month  
-    return String(year) + "-" + monthStr + "-" + dayStr;    
+    unsigned long secs = this->_ntp.getEpochTime() % 86400L;
+    char *out = writeDigits(buffer, secs / 3600, 2);
+    *out++ = ':';
+    out = writeDigits(out, (secs / 60) % 60, 2);
+    *out++ = ':';
+    out = writeDigits(out, secs % 60, 2);
+    *out = '\0';
+    return NTP_TIME_SIZE - 1;
+}
+
+size_t NTPUtilityClass::getISO8601Formatted(char *buffer, size_t size)   // Convert epoch time to ISO8601 formatted date/time
+{
+    if (size < NTP_ISO8601_SIZE)
+    {
+        return 0;
+    }
+    // Read the epoch once so the date and time always agree at midnight
+    unsigned long epoch = this->_ntp.getEpochTime();
+    unsigned long secs = epoch % 86400L;
+    this->updateDate(epoch);
+    memcpy(buffer, this->_date, NTP_DATE_SIZE - 1);
+    char *out = buffer + NTP_DATE_SIZE - 1;
+    *out++ = 'T';
+    out = writeDigits(out, secs / 3600, 2);
+    *out++ = ':';
+    out = writeDigits(out, (secs / 60) % 60, 2);
+    *out++ = ':';
+    out = writeDigits(out, secs % 60, 2);
+    *out++ = 'Z';
+    *out = '\0';
+    return NTP_ISO8601_SIZE - 1;
+}
+
+String NTPUtilityClass::getFormattedDate()
+{
+    char buffer[NTP_DATE_SIZE];
+    this->getFormattedDate(buffer, sizeof(buffer));
+    return String(buffer);
 }
 
-String NTPUtilityClass::getISO8601Formatted()   // Convert epoch time to ISO8601 formatted date/time
+String NTPUtilityClass::getISO8601Formatted()
 {
-    String date = this->getFormattedDate();
-    return date + String("T") + this->_ntp.getFormattedTime() + "Z";
+    char buffer[NTP_ISO8601_SIZE];
+    this->getISO8601Formatted(buffer, sizeof(buffer));
+    return String(buffer);
 }
 
-String NTPUtilityClass::getFormattedTime()      // Get the formatted time from the generic NTP Client
+String NTPUtilityClass::getFormattedTime()
 {
-    return this->_ntp.getFormattedTime();
+    char buffer[NTP_TIME_SIZE];
+    this->getFormattedTime(buffer, sizeof(buffer));
+    return String(buffer);
 }
 
 void NTPUtilityClass::tick()                  // Call the NTP update function to pool the site